@@ -0,0 +1,91 @@
+#include "glm_parser.h"
+
+// Count-min sketch over feature hashes
+//
+// depth rows of width saturating 16-bit counters. Every row has its own
+// multiplicative hash, and the count of a key is the smallest of its 
+// counters, which is never below the true count. It is used to keep 
+// rare features out of the weight table (see train_perceptron()) in a
+// fixed amount of memory, whatever the number of distinct features
+
+static const uint64_t sketch_multiplier_list[SKETCH_MAX_DEPTH] = 
+{
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 
+    0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL,
+    0xFF51AFD7ED558CCDULL, 0xC4CEB9FE1A85EC53ULL,
+    0x87C37B91114253D5ULL, 0x4CF5AD432745937FULL,
+};
+
+CountSketch::CountSketch()
+{
+    depth = 0;
+    width = 0;
+    shift = 64;
+    count_list = NULL;
+}
+
+CountSketch::~CountSketch()
+{
+    free(count_list);
+}
+
+// Use about byte_size bytes, rounded down to a power of two per row
+void init_count_sketch(CountSketch *sketch, unsigned long byte_size, 
+                       int depth)
+{
+    if(depth < 1 || depth > SKETCH_MAX_DEPTH) 
+        ERROR("Invalid sketch depth: %d", depth);
+    
+    // At least two columns, so that shift stays below 64
+    unsigned long width = 2;
+    int bit_num = 1;
+    while(width * 2 * depth * sizeof(uint16_t) <= byte_size) 
+    {
+        width <<= 1;
+        bit_num++;
+    }
+    
+    free(sketch->count_list);
+    sketch->count_list = (uint16_t *)calloc(width * depth, sizeof(uint16_t));
+    if(sketch->count_list == NULL) 
+        ERROR("Allocate count sketch of %lu bytes fails!", byte_size);
+    
+    sketch->depth = depth;
+    sketch->width = width;
+    sketch->shift = 64 - bit_num;
+    
+    return;
+}
+
+inline uint16_t *get_sketch_counter(const CountSketch *sketch, int row, 
+                                    unsigned long h)
+{
+    unsigned long column = (unsigned long)(((uint64_t)h * 
+                           sketch_multiplier_list[row]) >> sketch->shift);
+    
+    return &sketch->count_list[row * sketch->width + column];
+}
+
+void add_count_sketch(CountSketch *sketch, unsigned long h)
+{
+    for(int i = 0;i < sketch->depth;i++)
+    {
+        uint16_t *counter = get_sketch_counter(sketch, i, h);
+        if(*counter < UINT16_MAX) (*counter)++;
+    }
+    
+    return;
+}
+
+unsigned int query_count_sketch(const CountSketch *sketch, unsigned long h)
+{
+    unsigned int count = UINT16_MAX;
+    
+    for(int i = 0;i < sketch->depth;i++)
+    {
+        uint16_t counter = *get_sketch_counter(sketch, i, h);
+        if(counter < count) count = counter;
+    }
+    
+    return count;
+}
@@ -2,8 +2,19 @@
 #include "glm_parser.h"
 
 static vector<Section> section_list;
+atomic<unsigned long> sentence_generation(0);
 static string data_root_path;
 
+Sentence::Sentence()
+{
+    length = 0;
+    word_list = pos_list = five_gram_word_list = NULL;
+    five_gram_flag = NULL;
+    gold_edge_num = 0;
+    gold_edge_list = NULL;
+    generation = ++sentence_generation;
+}
+
 // Scans from the first chaarcter till trailing '\0'
 // return true if all characters encountered are one of:
 // '\t', ' ', '\n'
@@ -20,79 +31,150 @@ static bool is_empty_line(char *line)
     return true;
 }
 
+// Function used by load_all_sections() to load a single file
+// Tokens are interned into vocab, which is local to the file
+// Returns the number of bytes consumed
+static long load_data_from_file_mmap(SectionFile *sf_p, Vocabulary *vocab);
+static long (*load_file)(SectionFile *sf_p, Vocabulary *vocab) = 
+    load_data_from_file_mmap;
+
+// Start a new sentence at the end of the pools with the implied ROOT
+static void begin_sentence(SectionFile *sf_p)
+{
+    sf_p->word_pool.push_back(ROOT_WORD_ID);
+    sf_p->five_gram_word_pool.push_back(ROOT_WORD_ID);
+    sf_p->pos_pool.push_back(ROOT_POS_ID);
+    sf_p->five_gram_flag_pool.push_back(0);
+    
+    return;
+}
+
+// Append one line of the input file to the current sentence
+// current_index is the index of this token (ROOT = 0)
+static void append_token(SectionFile *sf_p, Vocabulary *vocab,
+                         const char *word, int word_len, 
+                         const char *pos, int pos_len, 
+                         int father_index, int current_index)
+{
+    // Five gram only exists if the word is longer than 5 characters
+    if(word_len <= 5) 
+    {
+        sf_p->five_gram_flag_pool.push_back(0);
+        sf_p->five_gram_word_pool.push_back(INVALID_WORD_ID);
+    }
+    else
+    {
+        sf_p->five_gram_flag_pool.push_back(1);
+        sf_p->five_gram_word_pool.push_back(intern_token(vocab, word, 5));
+    }
+    
+    sf_p->word_pool.push_back(intern_token(vocab, word, word_len));
+    sf_p->pos_pool.push_back(intern_token(vocab, pos, pos_len));
+    
+    sf_p->gold_edge_pool.push_back(Edge(father_index, current_index));
+    
+    return;
+}
+
+// length is the number of tokens including ROOT
+// Pointers are left NULL since pools may still grow. They are set 
+// by bind_sentence_list() after the whole file is loaded
+static void end_sentence(SectionFile *sf_p, int length)
+{
+    Sentence st;
+    
+    st.length = length;
+    st.gold_edge_num = length - 1;
+    
+    sf_p->sentence_list.push_back(st);
+    
+    return;
+}
+
+// Point every sentence into the pools of its file
+static void bind_sentence_list(SectionFile *sf_p)
+{
+    unsigned long generation = ++sentence_generation;
+    int token_offset = 0, edge_offset = 0;
+    
+    for(int i = 0;i < (int)sf_p->sentence_list.size();i++)
+    {
+        Sentence *st = &sf_p->sentence_list[i];
+        
+        st->word_list = &sf_p->word_pool[token_offset];
+        st->pos_list = &sf_p->pos_pool[token_offset];
+        st->five_gram_word_list = &sf_p->five_gram_word_pool[token_offset];
+        st->five_gram_flag = &sf_p->five_gram_flag_pool[token_offset];
+        st->gold_edge_list = &sf_p->gold_edge_pool[edge_offset];
+        st->generation = generation;
+        
+        token_offset += st->length;
+        edge_offset += st->gold_edge_num;
+    }
+    
+    return;
+}
+
+// Translate file local token IDs into IDs of the global vocabulary
+static void remap_token_id(SectionFile *sf_p, vector<unsigned int> *id_map)
+{
+    vector<unsigned int> *pool_list[3] = 
+        {&sf_p->word_pool, &sf_p->pos_pool, &sf_p->five_gram_word_pool};
+    
+    for(int i = 0;i < 3;i++)
+    {
+        vector<unsigned int> *pool = pool_list[i];
+        
+        for(int j = 0;j < (int)pool->size();j++) 
+            (*pool)[j] = (*id_map)[(*pool)[j]];
+    }
+    
+    return;
+}
+
 // Load sentence from files
-static void load_data_from_file(SectionFile *sf_p)
+// This is the old fgets() + sscanf() path. It is kept for comparing
+// throughput with load_data_from_file_mmap()
+static long load_data_from_file(SectionFile *sf_p, Vocabulary *vocab)
 {
     char line_buffer[LINE_BUFFER_MAX];
     char word_str[WORD_MAX];
     char pos_str[POS_MAX];
-    char five_gram_word_str[WORD_MAX];
     
     int father_index;
     int state = STATE_FINISHED;
     
-    // These two are shared between all sentences (actually copied)
-    static const string ROOT_WORD = string("__ROOT__");
-    static const string ROOT_POS = string("ROOT");
-    // If five gram does not exist
-    static const string INVALID_WORD = string("__INV__");
-    
     string *filename_p = &sf_p->filename;
 
     FILE *fp = fopen(filename_p->c_str(), "r");
     if(fp == NULL) ERROR("Open file %s fails!", filename_p->c_str());
 
-    Sentence st;
-    // These are implied but not in the file
-    st.word_list.push_back(ROOT_WORD);
-    st.five_gram_word_list.push_back(ROOT_WORD);
-    st.pos_list.push_back(ROOT_POS);
-    st.five_gram_flag.push_back(false);
     // Starts from 1 because ROOT is implied
     int current_index = 1;
     //DEBUG("%s", sf_p->filename.c_str());
-    while(!feof(fp))
+    while(fgets(line_buffer, LINE_BUFFER_MAX, fp) != NULL)
     {   
-        fgets(line_buffer, LINE_BUFFER_MAX, fp);
         if(is_empty_line(line_buffer))
         {
             if(state == STATE_FINISHED) continue;
             
             state = STATE_FINISHED;
             
-            sf_p->sentence_list.push_back(st);
-            st = Sentence();
-            st.word_list.push_back(ROOT_WORD);
-            st.five_gram_word_list.push_back(ROOT_WORD);
-            st.pos_list.push_back(ROOT_POS);
-            st.five_gram_flag.push_back(false);
+            end_sentence(sf_p, current_index);
             current_index = 1;
         }
         else
         {
+            // ROOT is implied but not in the file
+            if(state == STATE_FINISHED) begin_sentence(sf_p);
             state = STATE_PROCESSING;
             
             // Extract word, pos and father index
             sscanf(line_buffer, "%s %s %d", word_str, pos_str, &father_index);
-            // Extract five gram using format string hach
-            sscanf(line_buffer, "%5s", five_gram_word_str);
-            
-            // If five gram does not exist
-            if(strlen(five_gram_word_str) == strlen(word_str)) 
-			{
-				st.five_gram_flag.push_back(false);
-				st.five_gram_word_list.push_back(INVALID_WORD);
-			}
-            else
-			{
-			 	st.five_gram_flag.push_back(true);
-			 	st.five_gram_word_list.push_back(string(five_gram_word_str));
-			}
             
-            st.word_list.push_back(string(word_str));
-            st.pos_list.push_back(string(pos_str));
-            
-            st.gold_edge_list.push_back(Edge(father_index, current_index));
+            append_token(sf_p, vocab, word_str, strlen(word_str), 
+                         pos_str, strlen(pos_str), 
+                         father_index, current_index);
             
             current_index++;
             
@@ -100,26 +182,209 @@ static void load_data_from_file(SectionFile *sf_p)
         }
     }
     
-    if(state == STATE_PROCESSING) sf_p->sentence_list.push_back(st);
+    if(state == STATE_PROCESSING) end_sentence(sf_p, current_index);
+
+    long byte_count = ftell(fp);
+    fclose(fp);
+    
+    return byte_count;
+}
+
+static inline bool is_blank_char(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+// Split [p, line_end) into whitespace separated fields
+// Returns the number of fields found (at most 3). word and pos are 
+// views into the line, and father index is converted in place
+static int scan_line(const char *p, const char *line_end, 
+                     TokenView *word, TokenView *pos, int *father_index)
+{
+    TokenView *view_list[2] = {word, pos};
+    int field_num = 0;
+    
+    while(field_num < 2)
+    {
+        while(p < line_end && is_blank_char(*p)) p++;
+        if(p == line_end) return field_num;
+        
+        view_list[field_num]->str = p;
+        while(p < line_end && !is_blank_char(*p)) p++;
+        view_list[field_num]->len = p - view_list[field_num]->str;
+        
+        field_num++;
+    }
+    
+    while(p < line_end && is_blank_char(*p)) p++;
+    if(p == line_end) return field_num;
+    
+    bool negative = false;
+    if(*p == '-') 
+    {
+        negative = true;
+        p++;
+    }
+    
+    int value = 0;
+    while(p < line_end && *p >= '0' && *p <= '9') 
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    
+    *father_index = negative ? -value : value;
+    
+    // Anything after the third field is ignored, same as sscanf()
+    return 3;
+}
+
+// Load sentences from a file image of length len. The image is scanned 
+// in place without any intermediate line buffer; tokens are only copied
+// once when they are stored into the Sentence
+static void load_data_from_buffer(SectionFile *sf_p, Vocabulary *vocab,
+                                  const char *buf, size_t len)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    int state = STATE_FINISHED;
+    int current_index = 1;
+    
+    while(p < end)
+    {
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        if(line_end == NULL) line_end = end;
+        
+        TokenView word, pos;
+        int father_index;
+        int field_num = scan_line(p, line_end, &word, &pos, &father_index);
+        
+        if(field_num == 0)
+        {
+            if(state == STATE_PROCESSING) 
+            {
+                state = STATE_FINISHED;
+                
+                end_sentence(sf_p, current_index);
+                current_index = 1;
+            }
+        }
+        else if(field_num < 3)
+        {
+            ERROR("Malformed line in file %s", sf_p->filename.c_str());
+        }
+        else
+        {
+            if(state == STATE_FINISHED) begin_sentence(sf_p);
+            state = STATE_PROCESSING;
+            
+            append_token(sf_p, vocab, word.str, word.len, pos.str, pos.len, 
+                         father_index, current_index);
+            
+            current_index++;
+        }
+        
+        p = line_end + 1;
+    }
+    
+    if(state == STATE_PROCESSING) end_sentence(sf_p, current_index);
+    
+    return;
+}
 
+// Map the whole file into memory and scan it with load_data_from_buffer()
+static long load_data_from_file_mmap(SectionFile *sf_p, Vocabulary *vocab)
+{
+    const char *filename = sf_p->filename.c_str();
+    size_t len;
+    
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) ERROR("Open file %s fails!", filename);
+    
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0) ERROR("Stat file %s fails!", filename);
+    len = file_stat.st_size;
+    
+    // mmap() refuses zero length mappings
+    if(len != 0)
+    {
+        void *image = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(image == MAP_FAILED) ERROR("Map file %s fails!", filename);
+        madvise(image, len, MADV_SEQUENTIAL);
+        
+        load_data_from_buffer(sf_p, vocab, (const char *)image, len);
+        
+        munmap(image, len);
+    }
+    
+    close(fd);
+#else
+    // There is no mmap() on Windows, so just read the whole file with
+    // a single call and scan the buffer
+    FILE *fp = fopen(filename, "rb");
+    if(fp == NULL) ERROR("Open file %s fails!", filename);
+    
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    vector<char> image(len + 1);
+    if(fread(&image[0], 1, len, fp) != len) 
+        ERROR("Read file %s fails!", filename);
     fclose(fp);
+    
+    load_data_from_buffer(sf_p, vocab, &image[0], len);
+#endif
+
+    return (long)len;
 }
 
 // Read from static global: section_list
-static void load_all_sections()
+// Files are parsed by worker_num threads. Every file is loaded into its
+// own SectionFile with its own vocabulary, which are merged into the 
+// global one in file order afterwards. So neither sentence order nor 
+// token IDs depend on the scheduling
+// Returns the total number of bytes loaded
+static long load_all_sections(int worker_num)
 {
+    vector<SectionFile *> file_list;
+    
     for(int i = 0;i < section_list.size();i++)
     {
         Section *sect_p = &section_list[i];
         for(int j = 0;j < sect_p->file_list.size();j++)
         {
-            SectionFile *sf_p =  &(sect_p->file_list[j]);
-            
-            load_data_from_file(sf_p);
+            file_list.push_back(&(sect_p->file_list[j]));
         } 
     }
     
-    return;
+    vector<long> byte_count_list(file_list.size(), 0);
+    vector<Vocabulary> local_vocab_list(file_list.size());
+    ThreadPool pool(worker_num);
+    
+    pool.run(file_list.size(), [&](int file_index, int worker_index) {
+        Vocabulary *local_vocab = &local_vocab_list[file_index];
+        
+        byte_count_list[file_index] = load_file(file_list[file_index], 
+                                                local_vocab);
+        // Only the ID -> token mapping is needed for merging
+        unordered_map<string, unsigned int>().swap(local_vocab->index);
+    });
+    
+    long byte_count = 0;
+    vector<unsigned int> id_map;
+    for(int i = 0;i < (int)file_list.size();i++) 
+    {
+        merge_vocabulary(&vocabulary, &local_vocab_list[i], &id_map);
+        remap_token_id(file_list[i], &id_map);
+        bind_sentence_list(file_list[i]);
+        
+        clear_vocabulary(&local_vocab_list[i]);
+        byte_count += byte_count_list[i];
+    }
+    
+    return byte_count;
 }
 
 // Construct a section, and fill its file_list with SectionFile instances
@@ -211,18 +476,685 @@ static vector<int> section_range(int start, int end)
     return sect_range;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Binary corpus cache
+
+// The cache image stays mapped for the whole run, since sentences loaded
+// from it point directly into the image
+static const char *cache_image = NULL;
+static size_t cache_len = 0;
+
+static uint64_t align_cache_offset(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static void write_cache_array(FILE *fp, uint64_t offset, const void *data, 
+                              size_t len)
+{
+    if(fseek(fp, offset, SEEK_SET) != 0 ||
+       (len != 0 && fwrite(data, 1, len, fp) != len))
+        ERROR("Write corpus cache fails at offset %lu", (unsigned long)offset);
+    
+    return;
+}
+
+// Stat the source file. Returns false if it does not exist
+static bool get_file_stamp(const string &filename, int64_t *mtime, int64_t *size)
+{
+    struct stat file_stat;
+    if(stat(filename.c_str(), &file_stat) != 0) return false;
+    
+    *mtime = (int64_t)file_stat.st_mtime;
+    *size = (int64_t)file_stat.st_size;
+    
+    return true;
+}
+
+// Write all sentences in section_list into the cache at cache_path
+// The cache is written to a temporary file first, and renamed in the end
+static void save_corpus_cache(string cache_path)
+{
+    CorpusCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    
+    vector<CorpusCacheSection> cache_section_list;
+    vector<CorpusCacheFile> cache_file_list;
+    vector<uint32_t> length_list;
+    vector<uint64_t> vocab_offset_list;
+    string text;
+    
+    for(unsigned int i = 0;i < vocabulary.token_num;i++)
+    {
+        vocab_offset_list.push_back(text.size());
+        text += get_vocabulary_entry(&vocabulary, i)->token;
+    }
+    vocab_offset_list.push_back(text.size());
+    
+    for(int i = 0;i < (int)section_list.size();i++)
+    {
+        Section *s_p = &section_list[i];
+        CorpusCacheSection cs;
+        cs.section_id = s_p->section_id;
+        cs.file_num = s_p->file_list.size();
+        cache_section_list.push_back(cs);
+        
+        for(int j = 0;j < (int)s_p->file_list.size();j++)
+        {
+            SectionFile *sf_p = &s_p->file_list[j];
+            CorpusCacheFile cf;
+            memset(&cf, 0, sizeof(cf));
+            
+            if(!get_file_stamp(sf_p->filename, &cf.mtime, &cf.size))
+                ERROR("Stat file %s fails!", sf_p->filename.c_str());
+            
+            string name = sf_p->filename.substr(sf_p->filename.rfind('/') + 1);
+            cf.name_offset = text.size();
+            cf.name_len = name.size();
+            text += name;
+            
+            cf.sentence_num = sf_p->sentence_list.size();
+            cache_file_list.push_back(cf);
+            
+            for(int k = 0;k < (int)sf_p->sentence_list.size();k++)
+            {
+                Sentence *st = &sf_p->sentence_list[k];
+                
+                length_list.push_back(st->length);
+                header.token_num += st->length;
+                header.edge_num += st->gold_edge_num;
+            }
+        }
+    }
+    
+    header.magic = CORPUS_CACHE_MAGIC;
+    header.version = CORPUS_CACHE_VERSION;
+    header.section_num = cache_section_list.size();
+    header.file_num = cache_file_list.size();
+    header.sentence_num = length_list.size();
+    header.vocab_num = vocabulary.token_num;
+    header.text_size = text.size();
+    
+    uint64_t offset = align_cache_offset(sizeof(header));
+    header.section_offset = offset;
+    offset = align_cache_offset(offset + 
+        sizeof(CorpusCacheSection) * header.section_num);
+    header.file_offset = offset;
+    offset = align_cache_offset(offset + 
+        sizeof(CorpusCacheFile) * header.file_num);
+    header.sentence_offset = offset;
+    offset = align_cache_offset(offset + sizeof(uint32_t) * header.sentence_num);
+    header.word_offset = offset;
+    offset = align_cache_offset(offset + sizeof(uint32_t) * header.token_num);
+    header.pos_offset = offset;
+    offset = align_cache_offset(offset + sizeof(uint32_t) * header.token_num);
+    header.five_gram_word_offset = offset;
+    offset = align_cache_offset(offset + sizeof(uint32_t) * header.token_num);
+    header.five_gram_flag_offset = offset;
+    offset = align_cache_offset(offset + header.token_num);
+    header.gold_edge_offset = offset;
+    offset = align_cache_offset(offset + sizeof(Edge) * header.edge_num);
+    header.vocab_offset = offset;
+    offset = align_cache_offset(offset + 
+        sizeof(uint64_t) * (header.vocab_num + 1));
+    header.text_offset = offset;
+    
+    string tmp_path = cache_path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if(fp == NULL) ERROR("Open file %s fails!", tmp_path.c_str());
+    
+    write_cache_array(fp, 0, &header, sizeof(header));
+    write_cache_array(fp, header.section_offset, cache_section_list.data(), 
+                      sizeof(CorpusCacheSection) * header.section_num);
+    write_cache_array(fp, header.file_offset, cache_file_list.data(),
+                      sizeof(CorpusCacheFile) * header.file_num);
+    write_cache_array(fp, header.sentence_offset, length_list.data(),
+                      sizeof(uint32_t) * header.sentence_num);
+    
+    // Pools of all files are written back to back, in file order
+    uint64_t token_offset = 0, edge_offset = 0;
+    for(int i = 0;i < (int)section_list.size();i++)
+    {
+        Section *s_p = &section_list[i];
+        
+        for(int j = 0;j < (int)s_p->file_list.size();j++)
+        {
+            SectionFile *sf_p = &s_p->file_list[j];
+            size_t token_num = sf_p->word_pool.size();
+            size_t edge_num = sf_p->gold_edge_pool.size();
+            
+            write_cache_array(fp, header.word_offset + 4 * token_offset, 
+                              sf_p->word_pool.data(), 4 * token_num);
+            write_cache_array(fp, header.pos_offset + 4 * token_offset, 
+                              sf_p->pos_pool.data(), 4 * token_num);
+            write_cache_array(fp, header.five_gram_word_offset + 4 * token_offset, 
+                              sf_p->five_gram_word_pool.data(), 4 * token_num);
+            write_cache_array(fp, header.five_gram_flag_offset + token_offset, 
+                              sf_p->five_gram_flag_pool.data(), token_num);
+            write_cache_array(fp, header.gold_edge_offset + 
+                              sizeof(Edge) * edge_offset, 
+                              sf_p->gold_edge_pool.data(), 
+                              sizeof(Edge) * edge_num);
+            
+            token_offset += token_num;
+            edge_offset += edge_num;
+        }
+    }
+    
+    write_cache_array(fp, header.vocab_offset, vocab_offset_list.data(),
+                      sizeof(uint64_t) * (header.vocab_num + 1));
+    write_cache_array(fp, header.text_offset, text.data(), text.size());
+    
+    if(fclose(fp) != 0) ERROR("Write corpus cache %s fails!", tmp_path.c_str());
+    if(rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+        ERROR("Rename %s fails!", tmp_path.c_str());
+    
+    return;
+}
+
+// Map the whole cache into cache_image. Returns false if it cannot be read
+static bool map_corpus_cache(string cache_path)
+{
+#ifndef _WIN32
+    int fd = open(cache_path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) 
+    {
+        close(fd);
+        return false;
+    }
+    
+    cache_len = file_stat.st_size;
+    void *image = mmap(NULL, cache_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) return false;
+    
+    cache_image = (const char *)image;
+#else
+    FILE *fp = fopen(cache_path.c_str(), "rb");
+    if(fp == NULL) return false;
+    
+    fseek(fp, 0, SEEK_END);
+    cache_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    // malloc() is aligned well enough for every array in the cache
+    char *image = (char *)malloc(cache_len);
+    if(image == NULL || fread(image, 1, cache_len, fp) != cache_len)
+    {
+        free(image);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    
+    cache_image = image;
+#endif
+
+    return true;
+}
+
+static void unmap_corpus_cache()
+{
+#ifndef _WIN32
+    munmap((void *)cache_image, cache_len);
+#else
+    free((void *)cache_image);
+#endif
+    
+    cache_image = NULL;
+    cache_len = 0;
+    
+    return;
+}
+
+// True if count elements of elem_size bytes at offset are inside the 
+// cache, and start at a multiple of 8 bytes. Never overflows, whatever
+// the header says
+static bool is_cache_array_valid(uint64_t offset, uint64_t count, 
+                                 uint64_t elem_size)
+{
+    return offset % 8 == 0 && offset <= cache_len && 
+           count <= (cache_len - offset) / elem_size;
+}
+
+// Check that the cache is complete and that it covers exactly the files
+// in section_list, none of which has changed since the cache was built. 
+// Every array load_corpus_cache() reads must be inside the cache, and 
+// counts of sections, files, sentences, tokens and edges must add up, so
+// that a truncated or damaged cache is rejected instead of read out of 
+// bounds
+static bool validate_corpus_cache()
+{
+    const CorpusCacheHeader *header = (const CorpusCacheHeader *)cache_image;
+    
+    if(cache_len < sizeof(CorpusCacheHeader) ||
+       header->magic != CORPUS_CACHE_MAGIC) return false;
+    if(header->version != CORPUS_CACHE_VERSION) return false;
+    if(header->section_num != section_list.size()) return false;
+    
+    if(!is_cache_array_valid(header->section_offset, header->section_num, 
+                             sizeof(CorpusCacheSection)) ||
+       !is_cache_array_valid(header->file_offset, header->file_num, 
+                             sizeof(CorpusCacheFile)) ||
+       !is_cache_array_valid(header->sentence_offset, header->sentence_num, 
+                             sizeof(uint32_t)) ||
+       !is_cache_array_valid(header->word_offset, header->token_num, 
+                             sizeof(uint32_t)) ||
+       !is_cache_array_valid(header->pos_offset, header->token_num, 
+                             sizeof(uint32_t)) ||
+       !is_cache_array_valid(header->five_gram_word_offset, header->token_num,
+                             sizeof(uint32_t)) ||
+       !is_cache_array_valid(header->five_gram_flag_offset, header->token_num,
+                             1) ||
+       !is_cache_array_valid(header->gold_edge_offset, header->edge_num, 
+                             sizeof(Edge)) ||
+       !is_cache_array_valid(header->vocab_offset, 
+                             (uint64_t)header->vocab_num + 1, 
+                             sizeof(uint64_t)) ||
+       !is_cache_array_valid(header->text_offset, header->text_size, 1)) 
+        return false;
+    if(header->text_offset + header->text_size != cache_len) return false;
+    
+    const CorpusCacheSection *cs = (const CorpusCacheSection *)
+        (cache_image + header->section_offset);
+    const CorpusCacheFile *cf = (const CorpusCacheFile *)
+        (cache_image + header->file_offset);
+    const uint32_t *length_list = (const uint32_t *)
+        (cache_image + header->sentence_offset);
+    const Edge *gold_edge_list = (const Edge *)
+        (cache_image + header->gold_edge_offset);
+    const uint64_t *vocab_offset_list = (const uint64_t *)
+        (cache_image + header->vocab_offset);
+    const char *text = cache_image + header->text_offset;
+    uint64_t file_num = 0, sentence_num = 0, token_num = 0, edge_num = 0;
+    
+    for(size_t i = 0;i < section_list.size();i++)
+    {
+        Section *s_p = &section_list[i];
+        if(cs[i].section_id != s_p->section_id || 
+           cs[i].file_num != s_p->file_list.size()) return false;
+        
+        file_num += cs[i].file_num;
+        if(file_num > header->file_num) return false;
+        
+        for(size_t j = 0;j < s_p->file_list.size();j++, cf++)
+        {
+            const string &filename = s_p->file_list[j].filename;
+            string name = filename.substr(filename.rfind('/') + 1);
+            int64_t mtime, size;
+            
+            if((uint64_t)cf->name_offset + cf->name_len > header->text_size)
+                return false;
+            if(name != string(text + cf->name_offset, cf->name_len)) 
+                return false;
+            if(!get_file_stamp(filename, &mtime, &size) || 
+               mtime != cf->mtime || size != cf->size) return false;
+            
+            if(cf->sentence_num > header->sentence_num - sentence_num) 
+                return false;
+            for(uint32_t k = 0;k < cf->sentence_num;k++)
+            {
+                uint32_t length = length_list[sentence_num++];
+                
+                // Every sentence has ROOT, and one gold edge per token
+                if(length == 0 || 
+                   length - 1 > header->edge_num - edge_num) return false;
+                for(uint32_t e = 0;e < length - 1;e++)
+                {
+                    const Edge *edge = &gold_edge_list[edge_num + e];
+                    if(edge->head_index < 0 || edge->dep_index <= 0 || 
+                       (uint32_t)edge->head_index >= length || 
+                       (uint32_t)edge->dep_index >= length) return false;
+                }
+                token_num += length;
+                edge_num += length - 1;
+            }
+        }
+    }
+    
+    if(file_num != header->file_num || 
+       sentence_num != header->sentence_num ||
+       token_num != header->token_num || 
+       edge_num != header->edge_num) return false;
+    
+    for(uint32_t i = 0;i < header->vocab_num;i++)
+    {
+        if(vocab_offset_list[i] > vocab_offset_list[i + 1]) return false;
+    }
+    if(vocab_offset_list[header->vocab_num] > header->text_size) return false;
+    
+    // Token IDs index the vocabulary of the cache
+    const uint32_t *id_list[3] = {
+        (const uint32_t *)(cache_image + header->word_offset),
+        (const uint32_t *)(cache_image + header->pos_offset),
+        (const uint32_t *)(cache_image + header->five_gram_word_offset)
+    };
+    for(int i = 0;i < 3;i++)
+    {
+        uint32_t max_id = 0;
+        for(uint64_t j = 0;j < header->token_num;j++) 
+            max_id = max(max_id, id_list[i][j]);
+        if(header->token_num > 0 && max_id >= header->vocab_num) return false;
+    }
+    
+    return true;
+}
+
+// Point sentences of section_list into the cache image
+// Returns false if the cache is stale, in which case nothing is changed
+static bool load_corpus_cache(string cache_path)
+{
+    if(!map_corpus_cache(cache_path)) return false;
+    if(!validate_corpus_cache()) 
+    {
+        unmap_corpus_cache();
+        return false;
+    }
+    
+    const CorpusCacheHeader *header = (const CorpusCacheHeader *)cache_image;
+    const CorpusCacheFile *cf = (const CorpusCacheFile *)
+        (cache_image + header->file_offset);
+    const uint32_t *length_list = (const uint32_t *)
+        (cache_image + header->sentence_offset);
+    const uint32_t *word_list = (const uint32_t *)
+        (cache_image + header->word_offset);
+    const uint32_t *pos_list = (const uint32_t *)
+        (cache_image + header->pos_offset);
+    const uint32_t *five_gram_word_list = (const uint32_t *)
+        (cache_image + header->five_gram_word_offset);
+    const unsigned char *five_gram_flag = (const unsigned char *)
+        (cache_image + header->five_gram_flag_offset);
+    const Edge *gold_edge_list = (const Edge *)
+        (cache_image + header->gold_edge_offset);
+    const uint64_t *vocab_offset_list = (const uint64_t *)
+        (cache_image + header->vocab_offset);
+    const char *text = cache_image + header->text_offset;
+    
+    // Token IDs in the cache can be used as is only if interning its 
+    // vocabulary reproduces the same IDs, which is the case when the 
+    // global vocabulary is empty on entry
+    vector<unsigned int> id_map(header->vocab_num);
+    bool identical_id = true;
+    for(unsigned int i = 0;i < header->vocab_num;i++)
+    {
+        id_map[i] = intern_token(&vocabulary, text + vocab_offset_list[i],
+                                 vocab_offset_list[i + 1] - vocab_offset_list[i]);
+        if(id_map[i] != i) identical_id = false;
+    }
+    
+    unsigned long generation = ++sentence_generation;
+    for(int i = 0;i < (int)section_list.size();i++)
+    {
+        Section *s_p = &section_list[i];
+        
+        for(int j = 0;j < (int)s_p->file_list.size();j++, cf++)
+        {
+            SectionFile *sf_p = &s_p->file_list[j];
+            const uint32_t *file_word_list = word_list;
+            const Edge *file_gold_edge_list = gold_edge_list;
+            
+            sf_p->sentence_list.resize(cf->sentence_num);
+            for(int k = 0;k < (int)cf->sentence_num;k++)
+            {
+                Sentence *st = &sf_p->sentence_list[k];
+                
+                st->length = *length_list++;
+                st->word_list = word_list;
+                st->pos_list = pos_list;
+                st->five_gram_word_list = five_gram_word_list;
+                st->five_gram_flag = five_gram_flag;
+                st->gold_edge_num = st->length - 1;
+                st->gold_edge_list = gold_edge_list;
+                st->generation = generation;
+                
+                word_list += st->length;
+                pos_list += st->length;
+                five_gram_word_list += st->length;
+                five_gram_flag += st->length;
+                gold_edge_list += st->gold_edge_num;
+            }
+            
+            if(identical_id) continue;
+            
+            // Otherwise copy the file into its pools and translate IDs
+            size_t token_num = word_list - file_word_list;
+            sf_p->word_pool.assign(file_word_list, word_list);
+            sf_p->pos_pool.assign(pos_list - token_num, pos_list);
+            sf_p->five_gram_word_pool.assign(five_gram_word_list - token_num,
+                                             five_gram_word_list);
+            sf_p->five_gram_flag_pool.assign(five_gram_flag - token_num,
+                                             five_gram_flag);
+            sf_p->gold_edge_pool.assign(file_gold_edge_list, gold_edge_list);
+            
+            remap_token_id(sf_p, &id_map);
+            bind_sentence_list(sf_p);
+        }
+    }
+    
+    if(!identical_id) unmap_corpus_cache();
+    
+    return true;
+}
+
+static void report_load_throughput(long byte_count, double elapsed)
+{
+    double mb = (double)byte_count / (1024.0 * 1024.0);
+    
+    fprintf(stderr, "Loaded %.2f MB in %.3f s (%.2f MB/s)\n", 
+            mb, elapsed, elapsed > 0.0 ? mb / elapsed : 0.0);
+    
+    return;
+}
+
 /////////////////////////////////////////////////////////
 // This is the main procedure exposed to other modules
-void load(int start, int end, string root_path)
+void load(int start, int end, string root_path, int worker_num, 
+          string cache_path)
+{
+    vector<int> v = section_range(start, end);
+    build_section_list(&v, root_path);
+    
+    double start_time = get_wall_time();
+    if(cache_path != "" && load_corpus_cache(cache_path))
+    {
+        fprintf(stderr, "Loaded corpus cache %s in %.3f ms\n", 
+                cache_path.c_str(), (get_wall_time() - start_time) * 1000.0);
+        
+        return;
+    }
+    
+    long byte_count = load_all_sections(worker_num);
+    report_load_throughput(byte_count, get_wall_time() - start_time);
+    
+    if(cache_path != "") save_corpus_cache(cache_path);
+    
+    return;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Streaming mode
+//
+// A producer thread loads files in order into a bounded queue, and 
+// get_next_sentence() consumes them. A file is released as soon as the
+// consumer moves past its last sentence, so a sentence returned in this 
+// mode is only valid until the next call. There is a single consumer
+
+struct StreamBatch
+{
+    SectionFile file;
+    int section_index;      // Into section_list
+    int file_index;         // Into Section.file_list
+};
+
+static bool stream_mode = false;
+static thread stream_producer;
+static mutex stream_lock;
+static condition_variable stream_data_cv;   // Batch queued or producer done
+static condition_variable stream_space_cv;  // In-flight sentences released
+static vector<StreamBatch *> stream_queue;  // Used as a FIFO
+static int stream_queue_head = 0;
+static StreamBatch *stream_current_batch = NULL;
+static int stream_in_flight_num = 0;        // Queued + being consumed
+static int stream_max_sentence_num = 0;
+static bool stream_producer_done = false;
+static bool stream_stopping = false;
+
+static void stream_producer_loop()
+{
+    vector<unsigned int> id_map;
+    
+    for(int i = 0;i < (int)section_list.size();i++)
+    {
+        Section *s_p = &section_list[i];
+        
+        for(int j = 0;j < (int)s_p->file_list.size();j++)
+        {
+            StreamBatch *batch = new StreamBatch();
+            batch->file.filename = s_p->file_list[j].filename;
+            batch->section_index = i;
+            batch->file_index = j;
+            
+            // Only this thread interns into the global vocabulary while
+            // streaming. Entries never move, so the consumer could still 
+            // read tokens of the batches it has received
+            Vocabulary local_vocab;
+            load_file(&batch->file, &local_vocab);
+            merge_vocabulary(&vocabulary, &local_vocab, &id_map);
+            remap_token_id(&batch->file, &id_map);
+            bind_sentence_list(&batch->file);
+            
+            int sentence_num = batch->file.sentence_list.size();
+            
+            unique_lock<mutex> guard(stream_lock);
+            // The size of a file is only known once it is parsed, so it is
+            // held here, not counted in flight, until there is room
+            // A file larger than the limit is let through when nothing 
+            // else is in flight, otherwise we would wait forever
+            stream_space_cv.wait(guard, [&] {
+                return stream_stopping || stream_in_flight_num == 0 ||
+                    stream_in_flight_num + sentence_num <= 
+                    stream_max_sentence_num;
+            });
+            
+            if(stream_stopping)
+            {
+                delete batch;
+                return;
+            }
+            
+            stream_in_flight_num += sentence_num;
+            stream_queue.push_back(batch);
+            stream_data_cv.notify_one();
+        }
+    }
+    
+    unique_lock<mutex> guard(stream_lock);
+    stream_producer_done = true;
+    stream_data_cv.notify_one();
+    
+    return;
+}
+
+// Stop the producer and release everything still in flight. It is called
+// automatically at the end of the stream, or could be called earlier to
+// abandon it
+void finish_stream()
+{
+    if(!stream_mode) return;
+    
+    {
+        unique_lock<mutex> guard(stream_lock);
+        stream_stopping = true;
+    }
+    stream_space_cv.notify_one();
+    stream_producer.join();
+    
+    for(int i = stream_queue_head;i < (int)stream_queue.size();i++) 
+        delete stream_queue[i];
+    delete stream_current_batch;
+    
+    stream_queue.clear();
+    stream_queue_head = 0;
+    stream_current_batch = NULL;
+    stream_in_flight_num = 0;
+    stream_mode = false;
+    
+    return;
+}
+
+// Start streaming sections [start, end] under root_path. At most 
+// max_sentence_num sentences are queued or being consumed at a time,
+// unless a single file has more than that. The producer parses a file 
+// before it waits for room for it, so one more file could be in memory 
+// on top of those
+void load_stream(int start, int end, string root_path, int max_sentence_num)
 {
+    if(stream_mode) ERROR("Another stream is still running!", 0);
+    if(max_sentence_num < 1) ERROR("Invalid in-flight limit: %d", 
+                                   max_sentence_num);
+    
     vector<int> v = section_range(start, end);
     build_section_list(&v, root_path);
     
-    load_all_sections();
+    stream_mode = true;
+    stream_max_sentence_num = max_sentence_num;
+    stream_producer_done = false;
+    stream_stopping = false;
+    stream_producer = thread(stream_producer_loop);
     
     return;
 }
 
+static Sentence *get_next_stream_sentence(Context *ctx)
+{
+    while(1)
+    {
+        StreamBatch *batch = stream_current_batch;
+        if(batch != NULL && 
+           ctx->current_sentence + 1 < (int)batch->file.sentence_list.size())
+        {
+            return &batch->file.sentence_list[++ctx->current_sentence];
+        }
+        
+        unique_lock<mutex> guard(stream_lock);
+        if(batch != NULL)
+        {
+            stream_in_flight_num -= batch->file.sentence_list.size();
+            stream_current_batch = NULL;
+            stream_space_cv.notify_one();
+            delete batch;
+        }
+        
+        stream_data_cv.wait(guard, [] {
+            return stream_queue_head < (int)stream_queue.size() || 
+                stream_producer_done;
+        });
+        
+        if(stream_queue_head == (int)stream_queue.size())
+        {
+            guard.unlock();
+            finish_stream();
+            
+            return NULL;
+        }
+        
+        stream_current_batch = stream_queue[stream_queue_head++];
+        // Reclaim the consumed part of the queue once it is drained
+        if(stream_queue_head == (int)stream_queue.size())
+        {
+            stream_queue.clear();
+            stream_queue_head = 0;
+        }
+        
+        ctx->current_section = stream_current_batch->section_index;
+        ctx->current_file = stream_current_batch->file_index;
+        ctx->current_sentence = -1;
+    }
+}
+
 static Section *get_next_section(Context *ctx)
 {
     if(ctx->current_section + 1 < section_list.size())
@@ -257,6 +1189,8 @@ static SectionFile *get_next_section_file(Context *ctx)
 // Returns NULL if we have already reached the end
 Sentence *get_next_sentence(Context *ctx)
 {
+    if(stream_mode) return get_next_stream_sentence(ctx);
+    
     Section *s_p = &section_list[ctx->current_section];
     SectionFile *sf_p = &s_p->file_list[ctx->current_file];
     
@@ -294,41 +1228,226 @@ static int get_sentence_count()
     return total;
 }
 
-int main()
+static bool is_same_sentence(Sentence *a, Sentence *b)
 {
-    vector<int> v = section_range(1, 24);
+    int n = a->length;
     
-    build_section_list(&v, string("D:/c-glm-parser/penn-wsj-deps/"));
-    for(int i = 0;i < section_list.size();i++)
+    if(n != b->length || a->gold_edge_num != b->gold_edge_num) return false;
+    if(memcmp(a->word_list, b->word_list, n * sizeof(unsigned int)) ||
+       memcmp(a->pos_list, b->pos_list, n * sizeof(unsigned int)) ||
+       memcmp(a->five_gram_word_list, b->five_gram_word_list, 
+              n * sizeof(unsigned int)) ||
+       memcmp(a->five_gram_flag, b->five_gram_flag, n))
+        return false;
+    
+    for(int i = 0;i < a->gold_edge_num;i++)
+    {
+        if(a->gold_edge_list[i].head_index != b->gold_edge_list[i].head_index ||
+           a->gold_edge_list[i].dep_index != b->gold_edge_list[i].dep_index) 
+            return false;
+    }
+    
+    return true;
+}
+
+// Walk section_list with get_next_sentence() and compare every sentence
+// with the one at the same position in expected
+// Returns the number of sentences that differ
+static int count_mismatch(vector<Section> *expected)
+{
+    Context ctx;
+    int mismatch = 0;
+    Sentence *sent;
+    
+    while((sent = get_next_sentence(&ctx)) != NULL) 
     {
-        //printf("Section id: %d\n", section_list[i].section_id);
-        for(int j = 0;j < section_list[i].file_list.size();j++) 0;
-            //printf("\tFile name: %s\n", section_list[i].file_list[j].filename.c_str());   
+        Sentence *expected_sent = &(*expected)[ctx.current_section].
+            file_list[ctx.current_file].sentence_list[ctx.current_sentence];
+        if(!is_same_sentence(sent, expected_sent)) mismatch++;
     }
     
-    clock_t start = clock();
-    load_all_sections();
-    clock_t end = clock();
-    DEBUG("Load complete, time = %ld", (long)(end - start));
+    return mismatch;
+}
+
+#define TRAIN_EPOCH_NUM 5
+
+// Train an averaged first order model on every loaded sentence and save
+// it to model_path
+static void train_corpus(string model_path, int worker_num)
+{
+    float accuracy = train_perceptron(TRAIN_EPOCH_NUM, worker_num, 0, true, 0, 
+                                      SKETCH_DEFAULT_SIZE, model_path);
+    DEBUG("Model saved to %s, training accuracy %.4f", model_path.c_str(), 
+          accuracy);
+}
+
+// Parse every loaded sentence with the model file at model_path and 
+// report the UAS against the gold trees
+static void parse_corpus(string model_path, int worker_num)
+{
     Context ctx;
-    int count = 0;
     Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
     while((sent = get_next_sentence(&ctx)) != NULL) 
+        sentence_list.push_back(sent);
+    if(sentence_list.size() == 0) ERROR("No sentence to parse", 0);
+    if(!map_model(&weight_vector, model_path)) 
+        ERROR("Model file %s is not valid", model_path.c_str());
+    
+    ThreadPool pool(worker_num);
+    double start_time = get_wall_time();
+    float uas = evaluate_uas(&pool, &sentence_list[0], sentence_list.size());
+    DEBUG("Parsed %d sentences in %.3f s, UAS %.4f", 
+          (int)sentence_list.size(), get_wall_time() - start_time, uas);
+}
+
+// Unit tests and benchmarks of every module. Leaves glm_model.bin in the
+// working directory
+static void run_test(int start_section, int end_section, string root_path, 
+                     int worker_num, vector<Section> *fgets_section_list)
+{
+    test();
+    test_feature_hash(200);
+    test_factorized_score(500);
+    test_in_between_score(2000);
+    test_batch_score(1000);
+    test_weight_table(2000000, 20000000);
+    test_weight_average(200000, 1000, 50);
+    test_model_file("glm_model_test.bin");
+    test_eisner();
+    profile_decode(2000);
+    test_decode_batch(2000, worker_num);
+    test_parallel_score(worker_num);
+    test_sibling_decode(500);
+    // Held out sentences are parsed with the model file mapped in place
+    train_perceptron(2, worker_num, 2000, true, 0, SKETCH_DEFAULT_SIZE, 
+                     "glm_model.bin");
+    if(!map_model(&weight_vector, "glm_model.bin")) 
+        ERROR("Model file %s is not valid", "glm_model.bin");
+    report_quantized_uas(2000, 1000, worker_num);
+    test_scorer_parity(&first_order_scorer, "first order", 2000, 1000, 
+                       worker_num);
+    test_scorer_parity(&factorized_scorer, "factorized", 2000, 1000, 
+                       worker_num);
+    train_perceptron(2, worker_num, 2000, true, 2, 4UL << 20);
+    report_quantized_uas(2000, 1000, worker_num);
+    test_arc_filter(2000, 1000, 0.01, worker_num);
+    test_arc_filter(2000, 1000, 0.02, worker_num);
+    
+    // Second order model, parsed with the sibling decoder
+    train_perceptron(2, worker_num, 2000, true, 0, SKETCH_DEFAULT_SIZE, "", 
+                     true);
+    tree_decoder = sibling_decode;
+    report_quantized_uas(2000, 1000, worker_num);
+    tree_decoder = eisner_decode;
+    
+    // Streaming mode only keeps a few files in memory at a time
+    section_list.clear();
+    double start_time = get_wall_time();
+    load_stream(start_section, end_section, root_path, 1000);
+    int mismatch = count_mismatch(fgets_section_list);
+    DEBUG("Streaming finished in %.3f s, mismatch = %d", 
+          get_wall_time() - start_time, mismatch);
+}
+
+// Usage: 
+// c-glm-parser [mode] [root path] [start section] [end section] [workers] 
+//              [file]
+// mode is one of
+//   load   (default) Loads the sections with the serial fgets() loader and 
+//          the parallel mmap() loader, reports their throughput and checks 
+//          that they produce the same sentences in the same order. If file
+//          is given, the corpus is also written to this cache and mapped 
+//          back from it
+//   train  Loads the sections, trains a model on them and saves it to file,
+//          glm_model.bin by default
+//   parse  Loads the sections and parses them with the model in file, 
+//          glm_model.bin by default
+//   test   Runs load, then the unit tests and benchmarks of every module
+int main(int argc, char **argv)
+{
+    string mode("load");
+    string root_path("D:/c-glm-parser/penn-wsj-deps/");
+    int start_section = 1, end_section = 24;
+    int worker_num = thread::hardware_concurrency();
+    
+    if(argc > 1 && (!strcmp(argv[1], "load") || !strcmp(argv[1], "train") || 
+                    !strcmp(argv[1], "parse") || !strcmp(argv[1], "test")))
+    {
+        mode = string(argv[1]);
+        argc--;
+        argv++;
+    }
+    if(argc > 1) root_path = string(argv[1]);
+    if(argc > 3) 
+    {
+        start_section = atoi(argv[2]);
+        end_section = atoi(argv[3]);
+    }
+    if(argc > 4) worker_num = atoi(argv[4]);
+    if(worker_num < 1) worker_num = 1;
+    
+    vector<int> v = section_range(start_section, end_section);
+    build_section_list(&v, root_path);
+    
+    if(mode == "train" || mode == "parse")
     {
-    	for(int i = 0;i < sent->word_list.size();i++)
-    	{
-    		DEBUG("%s %s %s %d", sent->word_list[i].c_str(), sent->pos_list[i].c_str(), 
-			                     sent->five_gram_word_list[i].c_str(), (int)sent->five_gram_flag[i]);
-		}
-        //DEBUG("%d %d %d", ctx.current_section, ctx.current_file, 
-        //                  ctx.current_sentence);
-        //getchar();
-        getchar();
-        count++;
+        string model_path(argc > 5 ? argv[5] : "glm_model.bin");
+        
+        double start_time = get_wall_time();
+        long byte_count = load_all_sections(worker_num);
+        fprintf(stderr, "mmap() loader, %d workers: ", worker_num);
+        report_load_throughput(byte_count, get_wall_time() - start_time);
+        
+        if(mode == "train") train_corpus(model_path, worker_num);
+        else parse_corpus(model_path, worker_num);
+        
+        return 0;
+    }
+    
+    double start_time = get_wall_time();
+    load_file = load_data_from_file;
+    long byte_count = load_all_sections(1);
+    fprintf(stderr, "fgets() loader: ");
+    report_load_throughput(byte_count, get_wall_time() - start_time);
+    
+    // Sentences point into their SectionFile, so move rather than copy
+    vector<Section> fgets_section_list = move(section_list);
+    section_list.clear();
+    build_section_list(&v, root_path);
+    
+    start_time = get_wall_time();
+    load_file = load_data_from_file_mmap;
+    byte_count = load_all_sections(worker_num);
+    fprintf(stderr, "mmap() loader, %d workers: ", worker_num);
+    report_load_throughput(byte_count, get_wall_time() - start_time);
+    
+    DEBUG("Finished, all = %d, mismatch = %d", get_sentence_count(), 
+          count_mismatch(&fgets_section_list));
+    
+    if(argc > 5)
+    {
+        string cache_path(argv[5]);
+        save_corpus_cache(cache_path);
+        
+        vector<Section> mmap_section_list = move(section_list);
+        section_list.clear();
+        build_section_list(&v, root_path);
+        
+        start_time = get_wall_time();
+        if(!load_corpus_cache(cache_path)) 
+            ERROR("Corpus cache %s is not valid", cache_path.c_str());
+        fprintf(stderr, "Corpus cache: loaded in %.3f ms\n", 
+                (get_wall_time() - start_time) * 1000.0);
+        
+        DEBUG("Finished, all = %d, mismatch = %d", get_sentence_count(), 
+              count_mismatch(&fgets_section_list));
     }
     
-    DEBUG("Finished, all = %d %d", get_sentence_count(), count);
-    getchar();
+    if(mode == "test") 
+        run_test(start_section, end_section, root_path, worker_num, 
+                 &fgets_section_list);
     
     return 0;
 }
@@ -0,0 +1,206 @@
+#include "glm_parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNEL
+#endif
+
+// Span combination kernels used by parser.c
+//
+// All of them return q in [begin, end) that maximizes (a[q] + b[q]) + c,
+// and the smallest such q on ties, which is what the scalar loops in
+// combine_triangle() etc. used to pick. end must be larger than begin.
+// The vector versions keep the best value and its first index per lane
+// (strictly greater wins), and reduce lanes by value then by index, so 
+// they choose exactly the same q as the scalar loop
+
+static int argmax_sum_scalar(const float *a, const float *b, int begin, 
+                             int end, float c, float *max_score_p)
+{
+    int max_index = begin;
+    float max_score = a[begin] + b[begin] + c;
+    float current_score;
+    
+    for(int q = begin + 1;q < end;q++)
+    {
+        current_score = a[q] + b[q] + c;
+        if(max_score < current_score)
+        {
+            max_score = current_score;
+            max_index = q;
+        }
+    }
+    
+    *max_score_p = max_score;
+    return max_index;
+}
+
+#ifdef HAVE_X86_KERNEL
+
+// Pick the best of lane_num (score, index) pairs, then continue the scalar
+// loop from q to end
+static int reduce_lane(const float *lane_score, const int *lane_index, 
+                       int lane_num, const float *a, const float *b, int q, 
+                       int end, float c, float *max_score_p)
+{
+    float max_score = lane_score[0];
+    int max_index = lane_index[0];
+    
+    for(int i = 1;i < lane_num;i++)
+    {
+        if(max_score < lane_score[i] || 
+           (max_score == lane_score[i] && lane_index[i] < max_index))
+        {
+            max_score = lane_score[i];
+            max_index = lane_index[i];
+        }
+    }
+    
+    float current_score;
+    for(;q < end;q++)
+    {
+        current_score = a[q] + b[q] + c;
+        if(max_score < current_score)
+        {
+            max_score = current_score;
+            max_index = q;
+        }
+    }
+    
+    *max_score_p = max_score;
+    return max_index;
+}
+
+// SSE2 is always there on x86-64
+__attribute__((target("sse2")))
+static int argmax_sum_sse(const float *a, const float *b, int begin, 
+                          int end, float c, float *max_score_p)
+{
+    if(end - begin < 8) 
+        return argmax_sum_scalar(a, b, begin, end, c, max_score_p);
+    
+    __m128 vc = _mm_set1_ps(c);
+    __m128 vmax = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a + begin), 
+                                        _mm_loadu_ps(b + begin)), vc);
+    __m128i vindex = _mm_setr_epi32(begin, begin + 1, begin + 2, begin + 3);
+    __m128i vcurrent = _mm_add_epi32(vindex, _mm_set1_epi32(4));
+    __m128i vstep = _mm_set1_epi32(4);
+    
+    int q = begin + 4;
+    for(;q + 4 <= end;q += 4)
+    {
+        __m128 v = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a + q), 
+                                         _mm_loadu_ps(b + q)), vc);
+        __m128 greater = _mm_cmpgt_ps(v, vmax);
+        __m128i greater_i = _mm_castps_si128(greater);
+        
+        vmax = _mm_or_ps(_mm_and_ps(greater, v), _mm_andnot_ps(greater, vmax));
+        vindex = _mm_or_si128(_mm_and_si128(greater_i, vcurrent), 
+                              _mm_andnot_si128(greater_i, vindex));
+        vcurrent = _mm_add_epi32(vcurrent, vstep);
+    }
+    
+    float lane_score[4];
+    int lane_index[4];
+    _mm_storeu_ps(lane_score, vmax);
+    _mm_storeu_si128((__m128i *)lane_index, vindex);
+    
+    return reduce_lane(lane_score, lane_index, 4, a, b, q, end, c, 
+                       max_score_p);
+}
+
+__attribute__((target("avx2")))
+static int argmax_sum_avx2(const float *a, const float *b, int begin, 
+                           int end, float c, float *max_score_p)
+{
+    if(end - begin < 16) 
+        return argmax_sum_sse(a, b, begin, end, c, max_score_p);
+    
+    __m256 vc = _mm256_set1_ps(c);
+    __m256 vmax = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(a + begin), 
+                                              _mm256_loadu_ps(b + begin)), vc);
+    __m256i vindex = _mm256_add_epi32(_mm256_set1_epi32(begin), 
+                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i vstep = _mm256_set1_epi32(8);
+    __m256i vcurrent = _mm256_add_epi32(vindex, vstep);
+    
+    int q = begin + 8;
+    for(;q + 8 <= end;q += 8)
+    {
+        __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(a + q), 
+                                               _mm256_loadu_ps(b + q)), vc);
+        __m256 greater = _mm256_cmp_ps(v, vmax, _CMP_GT_OQ);
+        
+        vmax = _mm256_blendv_ps(vmax, v, greater);
+        vindex = _mm256_castps_si256(
+            _mm256_blendv_ps(_mm256_castsi256_ps(vindex), 
+                             _mm256_castsi256_ps(vcurrent), greater));
+        vcurrent = _mm256_add_epi32(vcurrent, vstep);
+    }
+    
+    float lane_score[8];
+    int lane_index[8];
+    _mm256_storeu_ps(lane_score, vmax);
+    _mm256_storeu_si256((__m256i *)lane_index, vindex);
+    
+    return reduce_lane(lane_score, lane_index, 8, a, b, q, end, c, 
+                       max_score_p);
+}
+
+#endif
+
+static const char *kernel_name_list[] = {"scalar", "sse", "avx2"};
+
+static ArgmaxSumKernel kernel_list[] = 
+{
+    argmax_sum_scalar,
+#ifdef HAVE_X86_KERNEL
+    argmax_sum_sse,
+    argmax_sum_avx2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static bool is_kernel_supported(int kernel)
+{
+    if(kernel < 0 || kernel >= EISNER_KERNEL_NUM) return false;
+    
+#ifdef HAVE_X86_KERNEL
+    __builtin_cpu_init();
+    if(kernel == EISNER_KERNEL_SSE) return __builtin_cpu_supports("sse2");
+    if(kernel == EISNER_KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+    
+    return kernel_list[kernel] != NULL;
+}
+
+// Best kernel the CPU supports. This runs before main()
+static ArgmaxSumKernel select_best_kernel()
+{
+    for(int kernel = EISNER_KERNEL_NUM - 1;kernel >= 0;kernel--)
+    {
+        if(is_kernel_supported(kernel)) return kernel_list[kernel];
+    }
+    
+    return argmax_sum_scalar;
+}
+
+ArgmaxSumKernel argmax_sum = select_best_kernel();
+
+// Force a kernel, e.g. for comparison. Returns false if the CPU does not
+// support it, in which case the current one is kept
+bool set_eisner_kernel(int kernel)
+{
+    if(!is_kernel_supported(kernel)) return false;
+    
+    argmax_sum = kernel_list[kernel];
+    
+    return true;
+}
+
+const char *get_eisner_kernel_name(int kernel)
+{
+    return kernel_name_list[kernel];
+}
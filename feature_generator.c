@@ -1,10 +1,16 @@
 
 #include "glm_parser.h"
 
+// For the multi-lane hash_feature() of test()
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define HAVE_SSE2_HASH
+#endif
+
 
 // Direction and distance is "packed" into a single value - 
 // bucketed distance is left shifted 1 bit, and ORed with direction
-static int get_dir_and_dist(int head_index, int dep_index)
+int get_dir_and_dist(int head_index, int dep_index)
 {
     // On 64-bit machine this is the same
     unsigned long dist, dir;
@@ -87,19 +93,19 @@ float get_unigram_feature_score(Sentence *sent, int head_index, int dep_index)
     unsigned long h;
     register float score = 0.0;
     int dir_dist; 
-	static const unsigned char *feature_buffer[4];
+	const unsigned char *feature_buffer[4];
     
-    string *word_i = &sent->word_list[head_index];
-    string *pos_i = &sent->pos_list[head_index];
-    string *word_j = &sent->word_list[dep_index];
-    string *pos_j = &sent->pos_list[dep_index];
+    const unsigned char *word_i = get_token_str(sent->word_list[head_index]);
+    const unsigned char *pos_i = get_token_str(sent->pos_list[head_index]);
+    const unsigned char *word_j = get_token_str(sent->word_list[dep_index]);
+    const unsigned char *pos_j = get_token_str(sent->pos_list[dep_index]);
     
     dir_dist = get_dir_and_dist(head_index, dep_index);
     
-    feature_buffer[0] = (unsigned char *)word_i->c_str();
-    feature_buffer[1] = (unsigned char *)pos_i->c_str();
-    feature_buffer[2] = (unsigned char *)word_j->c_str();
-    feature_buffer[3] = (unsigned char *)pos_j->c_str();
+    feature_buffer[0] = word_i;
+    feature_buffer[1] = pos_i;
+    feature_buffer[2] = word_j;
+    feature_buffer[3] = pos_j;
     
     add_feature(0, 2, 0);
     add_feature(1, 1, 0);
@@ -110,21 +116,19 @@ float get_unigram_feature_score(Sentence *sent, int head_index, int dep_index)
     add_feature(5, 1, 3);
     
     // Add five gram word feature
-    if(sent->five_gram_flag[head_index] == true)
+    if(sent->five_gram_flag[head_index])
     {
-    	string *word_i_5 = &sent->five_gram_word_list[head_index];
-    	
-    	feature_buffer[0] = (unsigned char *)word_i_5->c_str();
+    	feature_buffer[0] = 
+    	    get_token_str(sent->five_gram_word_list[head_index]);
     	
     	add_feature(0, 2, 0);
     	add_feature(1, 1, 0);
     }
     
-    if(sent->five_gram_flag[dep_index] == true)
+    if(sent->five_gram_flag[dep_index])
     {
-    	string *word_j_5 = &sent->five_gram_word_list[dep_index];
-    	
-    	feature_buffer[2] = (unsigned char *)word_j_5->c_str();
+    	feature_buffer[2] = 
+    	    get_token_str(sent->five_gram_word_list[dep_index]);
     	
     	add_feature(3, 2, 2);
     	add_feature(4, 1, 2);
@@ -162,81 +166,83 @@ float get_bigram_feature_score(Sentence *sent, int head_index, int dep_index)
     unsigned long h;
     register float score = 0.0;
     int dir_dist; 
-	static const unsigned char *feature_buffer[4];
+	const unsigned char *feature_buffer[4];
     
-    string *word_i = &sent->word_list[head_index];
-    string *pos_i = &sent->pos_list[head_index];
-    string *word_j = &sent->word_list[dep_index];
-    string *pos_j = &sent->pos_list[dep_index];
+    const unsigned char *word_i = get_token_str(sent->word_list[head_index]);
+    const unsigned char *pos_i = get_token_str(sent->pos_list[head_index]);
+    const unsigned char *word_j = get_token_str(sent->word_list[dep_index]);
+    const unsigned char *pos_j = get_token_str(sent->pos_list[dep_index]);
     
     dir_dist = get_dir_and_dist(head_index, dep_index);
     
-    feature_buffer[0] = (unsigned char *)word_i->c_str();
-    feature_buffer[1] = (unsigned char *)pos_i->c_str();
-    feature_buffer[2] = (unsigned char *)word_j->c_str();
-    feature_buffer[3] = (unsigned char *)pos_j->c_str();
+    feature_buffer[0] = word_i;
+    feature_buffer[1] = pos_i;
+    feature_buffer[2] = word_j;
+    feature_buffer[3] = pos_j;
     
-    add_feature(6, 10, 0);
+    add_feature(6, 4, 0);
     add_feature(7, 3, 1);
     add_feature(10, 3, 0);
     
-    feature_buffer[2] = (unsigned char *)pos_j->c_str();
+    feature_buffer[2] = pos_j;
     
     add_feature(9, 3, 0);
     add_feature(12, 2, 1);
     
-    feature_buffer[1] = (unsigned char *)word_j->c_str();
+    feature_buffer[1] = word_j;
     
     add_feature(8, 3, 0);
 	add_feature(11, 2, 0);    
 	
 	// Add five gram word feature
-	string *word_i_5 = &sent->five_gram_word_list[head_index];
-    string *word_j_5 = &sent->five_gram_word_list[dep_index];
+	const unsigned char *word_i_5 = 
+	    get_token_str(sent->five_gram_word_list[head_index]);
+    const unsigned char *word_j_5 = 
+        get_token_str(sent->five_gram_word_list[dep_index]);
     
-    feature_buffer[0] = (unsigned char *)word_i_5->c_str();
-    feature_buffer[1] = (unsigned char *)pos_i->c_str();
-    feature_buffer[2] = (unsigned char *)word_j_5->c_str();
-    feature_buffer[3] = (unsigned char *)pos_j->c_str();
+    feature_buffer[0] = word_i_5;
+    feature_buffer[1] = pos_i;
+    feature_buffer[2] = word_j_5;
+    feature_buffer[3] = pos_j;
     
-    bool word_i_flag = sent->five_gram_flag[head_index];
-    bool word_j_flag = sent->five_gram_flag[dep_index];
+    bool word_i_flag = sent->five_gram_flag[head_index] != 0;
+    bool word_j_flag = sent->five_gram_flag[dep_index] != 0;
     
     if(word_i_flag == true && word_j_flag == true)
     {
-    	add_feature(6, 10, 0);
+    	add_feature(6, 4, 0);
     	add_feature(10, 3, 0);
     	add_feature(7, 3, 1);
     
-    	feature_buffer[2] = (unsigned char *)pos_j->c_str();
+    	feature_buffer[2] = pos_j;
  		add_feature(9, 3, 0);
     
-    	feature_buffer[1] = (unsigned char *)word_j_5->c_str();
+    	feature_buffer[1] = word_j_5;
     
     	add_feature(8, 3, 0);
 		add_feature(11, 2, 0);  
 	}
 	else if(word_i_flag == true)
 	{
-		add_feature(6, 10, 0);
+		add_feature(6, 4, 0);
     	add_feature(10, 3, 0);
     
-    	feature_buffer[2] = (unsigned char *)pos_j->c_str();
+    	feature_buffer[2] = pos_j;
  		add_feature(9, 3, 0);
     
-    	feature_buffer[1] = (unsigned char *)word_j_5->c_str();
+    	feature_buffer[1] = word_j_5;
     
     	add_feature(8, 3, 0);
 		add_feature(11, 2, 0);  
 	}
 	else if(word_j_flag == true)
     {
-    	add_feature(6, 10, 0);
+    	add_feature(6, 4, 0);
     	add_feature(10, 3, 0);
     	add_feature(7, 3, 1);
     
-    	feature_buffer[2] = (unsigned char *)pos_j->c_str();
-    	feature_buffer[1] = (unsigned char *)word_j_5->c_str();
+    	feature_buffer[2] = pos_j;
+    	feature_buffer[1] = word_j_5;
     
     	add_feature(8, 3, 0);
 		add_feature(11, 2, 0);  
@@ -253,10 +259,10 @@ float get_in_between_feature_score(Sentence *sent, int head_index, int dep_index
 	unsigned long h;
     register float score = 0.0;
     int dir_dist = get_dir_and_dist(head_index, dep_index); 
-	static const unsigned char *feature_buffer[3];
+	const unsigned char *feature_buffer[3];
 	
-	string *pos_i = &sent->pos_list[head_index];
-    string *pos_j = &sent->pos_list[dep_index];
+	const unsigned char *pos_i = get_token_str(sent->pos_list[head_index]);
+    const unsigned char *pos_j = get_token_str(sent->pos_list[dep_index]);
 	
 	int start_index, end_index;
 	if(head_index > dep_index) 
@@ -270,13 +276,12 @@ float get_in_between_feature_score(Sentence *sent, int head_index, int dep_index
 		end_index = dep_index;
 	}
 	
-	feature_buffer[0] = (unsigned char *)pos_i->c_str();
-	feature_buffer[2] = (unsigned char *)pos_j->c_str();
+	feature_buffer[0] = pos_i;
+	feature_buffer[2] = pos_j;
 	
 	for(int i = start_index;i < dep_index;i++)
 	{
-		string *pos_b = &sent->pos_list[i];
-		feature_buffer[1] = (unsigned char *)pos_b->c_str();
+		feature_buffer[1] = get_token_str(sent->pos_list[i]);
 		add_feature(12, 3, 0); 
 	}
 	
@@ -302,75 +307,75 @@ float get_surrounding_feature_score(Sentence *sent, int head_index, int dep_inde
 	unsigned long h;
     register float score = 0.0;
     int dir_dist = get_dir_and_dist(head_index, dep_index); 
-	static const unsigned char *feature_buffer[4];
-	int largest_index = sent->word_list.size() - 1;
+	const unsigned char *feature_buffer[4];
+	int largest_index = sent->length - 1;
 	// When we are at the boundry of the sentence
-	static string *null_pos = new string("_N_");
+	const unsigned char *null_pos = get_token_str(NULL_POS_ID);
 	
-	string *pos_i = &sent->pos_list[head_index];
-    string *pos_j = &sent->pos_list[dep_index];
-    string *pos_i_plus, *pos_i_minus, *pos_j_plus, *pos_j_minus;
+	const unsigned char *pos_i = get_token_str(sent->pos_list[head_index]);
+    const unsigned char *pos_j = get_token_str(sent->pos_list[dep_index]);
+    const unsigned char *pos_i_plus, *pos_i_minus, *pos_j_plus, *pos_j_minus;
     if(head_index == largest_index) pos_i_plus = null_pos;
-    else pos_i_plus = &sent->pos_list[head_index + 1];
+    else pos_i_plus = get_token_str(sent->pos_list[head_index + 1]);
     
     if(head_index == 0) pos_i_minus = null_pos;
-    else pos_i_minus = &sent->word_list[head_index - 1];
+    else pos_i_minus = get_token_str(sent->word_list[head_index - 1]);
     
     if(dep_index == largest_index) pos_j_plus = null_pos;
-    else pos_j_plus = &sent->pos_list[dep_index + 1];
+    else pos_j_plus = get_token_str(sent->pos_list[dep_index + 1]);
     
     if(dep_index == 0) pos_j_minus = null_pos;
-    else pos_j_minus = &sent->word_list[dep_index - 1];
+    else pos_j_minus = get_token_str(sent->word_list[dep_index - 1]);
     
-    feature_buffer[0] = (const unsigned char *)pos_i->c_str();
-    feature_buffer[1] = (const unsigned char *)pos_i_plus->c_str();
-    feature_buffer[2] = (const unsigned char *)pos_j_minus->c_str();
-    feature_buffer[3] = (const unsigned char *)pos_j->c_str();
+    feature_buffer[0] = pos_i;
+    feature_buffer[1] = pos_i_plus;
+    feature_buffer[2] = pos_j_minus;
+    feature_buffer[3] = pos_j;
     
 	//i i+1 j-1 j
     add_feature(13, 4, 0);
     
-    feature_buffer[2] = (const unsigned char *)pos_j->c_str();
+    feature_buffer[2] = pos_j;
     
     // i i+1 j j
     add_feature(14, 3, 0);
     
-    feature_buffer[1] = (const unsigned char *)pos_i->c_str();
-    feature_buffer[2] = (const unsigned char *)pos_j_minus->c_str();
+    feature_buffer[1] = pos_i;
+    feature_buffer[2] = pos_j_minus;
     
     // i i j-1 j
     add_feature(15, 3, 1);
     
-    feature_buffer[0] = (const unsigned char *)pos_i_minus->c_str();
+    feature_buffer[0] = pos_i_minus;
     
     // i-1 i j-1 j
     add_feature(16, 4, 0);
     add_feature(17, 3, 1);
     
-    feature_buffer[2] = (const unsigned char *)pos_j->c_str();
+    feature_buffer[2] = pos_j;
     
     // i-1 i j j
 	add_feature(18, 3, 0);
 	
-    feature_buffer[0] = (const unsigned char *)pos_i->c_str();
-    feature_buffer[1] = (const unsigned char *)pos_i_plus->c_str();
-    feature_buffer[3] = (const unsigned char *)pos_j_plus->c_str();
+    feature_buffer[0] = pos_i;
+    feature_buffer[1] = pos_i_plus;
+    feature_buffer[3] = pos_j_plus;
     
     // i i+1 j j+1
     add_feature(19, 4, 0);
     
-    feature_buffer[1] = (const unsigned char *)pos_i->c_str();
+    feature_buffer[1] = pos_i;
     
     // i i j j+1
     add_feature(20, 3, 1);
     
-    feature_buffer[1] = (const unsigned char *)pos_i_plus->c_str();
+    feature_buffer[1] = pos_i_plus;
     
     // i i+1 j j+1
     add_feature(21, 3, 0);
     
-    feature_buffer[0] = (const unsigned char *)pos_i_minus->c_str();
-    feature_buffer[1] = (const unsigned char *)pos_i->c_str();
+    feature_buffer[0] = pos_i_minus;
+    feature_buffer[1] = pos_i;
     
     // i-1 i j j+1
     add_feature(22, 4, 0);
@@ -380,7 +385,11 @@ float get_surrounding_feature_score(Sentence *sent, int head_index, int dep_inde
     return score;
 }
 
-float get_first_order_feature_score(Sentence *sent, int head_index, int dep_index)
+// The functions above hash the strings of every token again for every arc
+// and template. They are kept as the reference for the precomputed path 
+// below, which must produce exactly the same hash values
+float get_first_order_feature_score_reference(Sentence *sent, 
+                                              int head_index, int dep_index)
 {
 	float score = 0.0;
 	
@@ -392,25 +401,1575 @@ float get_first_order_feature_score(Sentence *sent, int head_index, int dep_inde
 	return score;
 } 
 
+///////////////////////////////////////////////////////////////////////
+// Precomputed feature hashing
+//
+// hash_feature() is a polynomial hash over the concatenated strings, so 
+// the hash of a template could be combined from the hash of every token
+// (see hash_concat()). Token hashes are computed once when the token is
+// interned; here they are gathered per sentence so that the O(n^2) loop
+// over arcs only touches two TokenFeatureHash entries per arc
+//
+// Generators below emit feature hashes in exactly the same order as the
+// string based functions above, through sink->add(h, type), where type
+// is the type value hashed into h (plain or packed with dir_dist)
+
+// Scoring functions call this themselves whenever the SentenceKey of the
+// sentence differs from the one hashed last
+void precompute_sentence_hash(ParserContext *pc, Sentence *sent)
+{
+    int n = sent->length;
+    const TokenHash *null_pos = get_token_hash(NULL_POS_ID);
+    
+    pc->token_hash_list.resize(n);
+    for(int i = 0;i < n;i++)
+    {
+        TokenFeatureHash *th = &pc->token_hash_list[i];
+        
+        th->word = *get_token_hash(sent->word_list[i]);
+        th->pos = *get_token_hash(sent->pos_list[i]);
+        th->five_gram_word = *get_token_hash(sent->five_gram_word_list[i]);
+        th->five_gram_flag = sent->five_gram_flag[i] != 0;
+        
+        // get_surrounding_feature_score() takes the word, not the POS,
+        // of the previous token. Keep it so that hash values do not change
+        if(i == 0) th->prev_pos = *null_pos;
+        else th->prev_pos = *get_token_hash(sent->word_list[i - 1]);
+        
+        if(i == n - 1) th->next_pos = *null_pos;
+        else th->next_pos = *get_token_hash(sent->pos_list[i + 1]);
+    }
+    
+    pc->hashed_key = SentenceKey(sent);
+    pc->in_between_key = SentenceKey();
+    pc->factorized_key = SentenceKey();
+    
+    return;
+}
+
+// h is the hash of the token strings. Same as add_feature()
+template<class Sink>
+inline void emit_feature(Sink *sink, unsigned long h, unsigned long type, 
+                         int dir_dist)
+{
+    unsigned long packed_type = pack_type_dir_dist(type, dir_dist);
+    
+    sink->add(h * HASH_MULTIPLIER + type, type);
+    sink->add(h * HASH_MULTIPLIER + packed_type, packed_type);
+    
+    return;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Feature template tables
+//
+// Every template is declared once, as FeatureTemplate<type, condition, 
+// slots...>, where slots are the token fields whose strings are 
+// concatenated, in that order. A family of templates is a TemplateList,
+// emitted in the order of declaration. All of it is resolved at compile 
+// time, so a family expands into straight hash_concat() and sink->add() 
+// calls, without a loop over slots or a buffer of strings
+// To add a template, add it to a family, or make a new family and call
+// it from a generator below. Changing the hash value of a feature that is
+// there already needs a new FEATURE_HASH_VERSION
+
+// Tokens a template could read. mid is a token between head and dep: the
+// one in between for in-between features, the sibling for second order
+struct TemplateToken
+{
+    const TokenFeatureHash *head;
+    const TokenFeatureHash *dep;
+    const TokenFeatureHash *mid;
+};
+
+enum TemplateSlot
+{
+    HEAD_WORD, HEAD_POS, HEAD_FIVE_GRAM, HEAD_PREV_POS, HEAD_NEXT_POS,
+    DEP_WORD, DEP_POS, DEP_FIVE_GRAM, DEP_PREV_POS, DEP_NEXT_POS,
+    MID_WORD, MID_POS
+};
+
+// Templates with five grams only fire if the token has a five gram
+enum TemplateCondition
+{
+    ALWAYS, HEAD_HAS_FIVE_GRAM, DEP_HAS_FIVE_GRAM, ANY_HAS_FIVE_GRAM
+};
+
+template<int slot> inline const TokenHash *get_slot(const TemplateToken &t);
+template<> inline const TokenHash *get_slot<HEAD_WORD>(const TemplateToken &t)
+{ return &t.head->word; }
+template<> inline const TokenHash *get_slot<HEAD_POS>(const TemplateToken &t)
+{ return &t.head->pos; }
+template<> inline const TokenHash *get_slot<HEAD_FIVE_GRAM>(const TemplateToken &t)
+{ return &t.head->five_gram_word; }
+template<> inline const TokenHash *get_slot<HEAD_PREV_POS>(const TemplateToken &t)
+{ return &t.head->prev_pos; }
+template<> inline const TokenHash *get_slot<HEAD_NEXT_POS>(const TemplateToken &t)
+{ return &t.head->next_pos; }
+template<> inline const TokenHash *get_slot<DEP_WORD>(const TemplateToken &t)
+{ return &t.dep->word; }
+template<> inline const TokenHash *get_slot<DEP_POS>(const TemplateToken &t)
+{ return &t.dep->pos; }
+template<> inline const TokenHash *get_slot<DEP_FIVE_GRAM>(const TemplateToken &t)
+{ return &t.dep->five_gram_word; }
+template<> inline const TokenHash *get_slot<DEP_PREV_POS>(const TemplateToken &t)
+{ return &t.dep->prev_pos; }
+template<> inline const TokenHash *get_slot<DEP_NEXT_POS>(const TemplateToken &t)
+{ return &t.dep->next_pos; }
+template<> inline const TokenHash *get_slot<MID_WORD>(const TemplateToken &t)
+{ return &t.mid->word; }
+template<> inline const TokenHash *get_slot<MID_POS>(const TemplateToken &t)
+{ return &t.mid->pos; }
+
+template<int condition> inline bool check_condition(const TemplateToken &t);
+template<> inline bool check_condition<ALWAYS>(const TemplateToken &t)
+{ return true; }
+template<> inline bool check_condition<HEAD_HAS_FIVE_GRAM>(const TemplateToken &t)
+{ return t.head->five_gram_flag; }
+template<> inline bool check_condition<DEP_HAS_FIVE_GRAM>(const TemplateToken &t)
+{ return t.dep->five_gram_flag; }
+template<> inline bool check_condition<ANY_HAS_FIVE_GRAM>(const TemplateToken &t)
+{ return t.head->five_gram_flag || t.dep->five_gram_flag; }
+
+// Appends the strings of slots to hash h, see hash_concat()
+template<int... slots> struct SlotConcat;
+
+template<> struct SlotConcat<>
+{
+    static unsigned long hash(unsigned long h, const TemplateToken &t) 
+    { 
+        return h; 
+    }
+};
+
+template<int first, int... rest> struct SlotConcat<first, rest...>
+{
+    static unsigned long hash(unsigned long h, const TemplateToken &t)
+    {
+        return SlotConcat<rest...>::hash(hash_concat(h, get_slot<first>(t)), t);
+    }
+};
+
+template<int type, int condition, int first, int... rest>
+struct FeatureTemplate
+{
+    // Hash of the token strings, before the type is added
+    static unsigned long hash(const TemplateToken &t)
+    {
+        return SlotConcat<rest...>::hash(get_slot<first>(t)->hash, t);
+    }
+    
+    template<class Sink>
+    static void emit(const TemplateToken &t, int dir_dist, Sink *sink)
+    {
+        if(check_condition<condition>(t)) 
+            emit_feature(sink, hash(t), type, dir_dist);
+    }
+};
+
+template<class... Templates> struct TemplateList;
+
+template<> struct TemplateList<>
+{
+    template<class Sink>
+    static void emit(const TemplateToken &t, int dir_dist, Sink *sink) {}
+};
+
+template<class First, class... Rest> struct TemplateList<First, Rest...>
+{
+    template<class Sink>
+    static void emit(const TemplateToken &t, int dir_dist, Sink *sink)
+    {
+        First::emit(t, dir_dist, sink);
+        TemplateList<Rest...>::emit(t, dir_dist, sink);
+    }
+};
+
+// See get_unigram_feature_score(). The templates of the head and those of
+// the dependent are split, so that they could be scored on their own
+typedef TemplateList<
+    FeatureTemplate<0, ALWAYS, HEAD_WORD, HEAD_POS>,
+    FeatureTemplate<1, ALWAYS, HEAD_WORD>,
+    FeatureTemplate<2, ALWAYS, HEAD_POS>,
+    FeatureTemplate<0, HEAD_HAS_FIVE_GRAM, HEAD_FIVE_GRAM, HEAD_POS>,
+    FeatureTemplate<1, HEAD_HAS_FIVE_GRAM, HEAD_FIVE_GRAM>
+> HeadTemplateList;
+
+typedef TemplateList<
+    FeatureTemplate<3, ALWAYS, DEP_WORD, DEP_POS>,
+    FeatureTemplate<4, ALWAYS, DEP_WORD>,
+    FeatureTemplate<5, ALWAYS, DEP_POS>,
+    FeatureTemplate<3, DEP_HAS_FIVE_GRAM, DEP_FIVE_GRAM, DEP_POS>,
+    FeatureTemplate<4, DEP_HAS_FIVE_GRAM, DEP_FIVE_GRAM>
+> DependentTemplateList;
+
+// See get_bigram_feature_score(). Five gram of a token without one is 
+// __INV__
+typedef TemplateList<
+    FeatureTemplate<6, ALWAYS, HEAD_WORD, HEAD_POS, DEP_WORD, DEP_POS>,
+    FeatureTemplate<7, ALWAYS, HEAD_POS, DEP_WORD, DEP_POS>,
+    FeatureTemplate<10, ALWAYS, HEAD_WORD, HEAD_POS, DEP_WORD>,
+    FeatureTemplate<9, ALWAYS, HEAD_WORD, HEAD_POS, DEP_POS>,
+    FeatureTemplate<12, ALWAYS, HEAD_POS, DEP_POS>,
+    FeatureTemplate<8, ALWAYS, HEAD_WORD, DEP_WORD, DEP_POS>,
+    FeatureTemplate<11, ALWAYS, HEAD_WORD, DEP_WORD>,
+    FeatureTemplate<6, ANY_HAS_FIVE_GRAM, 
+                    HEAD_FIVE_GRAM, HEAD_POS, DEP_FIVE_GRAM, DEP_POS>,
+    FeatureTemplate<10, ANY_HAS_FIVE_GRAM, 
+                    HEAD_FIVE_GRAM, HEAD_POS, DEP_FIVE_GRAM>,
+    FeatureTemplate<7, DEP_HAS_FIVE_GRAM, HEAD_POS, DEP_FIVE_GRAM, DEP_POS>,
+    FeatureTemplate<9, HEAD_HAS_FIVE_GRAM, HEAD_FIVE_GRAM, HEAD_POS, DEP_POS>,
+    FeatureTemplate<8, ANY_HAS_FIVE_GRAM, 
+                    HEAD_FIVE_GRAM, DEP_FIVE_GRAM, DEP_POS>,
+    FeatureTemplate<11, ANY_HAS_FIVE_GRAM, HEAD_FIVE_GRAM, DEP_FIVE_GRAM>
+> BigramTemplateList;
+
+// See get_in_between_feature_score(), fired once for every mid
+typedef FeatureTemplate<12, ALWAYS, HEAD_POS, MID_POS, DEP_POS> 
+    InBetweenTemplate;
+
+// See get_surrounding_feature_score()
+typedef TemplateList<
+    FeatureTemplate<13, ALWAYS, HEAD_POS, HEAD_NEXT_POS, DEP_PREV_POS, DEP_POS>,
+    FeatureTemplate<14, ALWAYS, HEAD_POS, HEAD_NEXT_POS, DEP_POS>,
+    FeatureTemplate<15, ALWAYS, HEAD_POS, DEP_PREV_POS, DEP_POS>,
+    FeatureTemplate<16, ALWAYS, HEAD_PREV_POS, HEAD_POS, DEP_PREV_POS, DEP_POS>,
+    FeatureTemplate<17, ALWAYS, HEAD_POS, DEP_PREV_POS, DEP_POS>,
+    FeatureTemplate<18, ALWAYS, HEAD_PREV_POS, HEAD_POS, DEP_POS>,
+    FeatureTemplate<19, ALWAYS, HEAD_POS, HEAD_NEXT_POS, DEP_POS, DEP_NEXT_POS>,
+    FeatureTemplate<20, ALWAYS, HEAD_POS, DEP_POS, DEP_NEXT_POS>,
+    FeatureTemplate<21, ALWAYS, HEAD_POS, HEAD_NEXT_POS, DEP_POS>,
+    FeatureTemplate<22, ALWAYS, HEAD_PREV_POS, HEAD_POS, DEP_POS, DEP_NEXT_POS>,
+    FeatureTemplate<23, ALWAYS, HEAD_POS, DEP_POS, DEP_NEXT_POS>,
+    FeatureTemplate<24, ALWAYS, HEAD_PREV_POS, HEAD_POS, DEP_POS>
+> SurroundingTemplateList;
+
+// Second order, mid is the sibling, see generate_sibling_feature()
+typedef TemplateList<
+    FeatureTemplate<25, ALWAYS, HEAD_POS, MID_POS, DEP_POS>,
+    FeatureTemplate<26, ALWAYS, MID_POS, DEP_POS>,
+    FeatureTemplate<27, ALWAYS, MID_WORD, DEP_WORD>,
+    FeatureTemplate<28, ALWAYS, MID_WORD, DEP_POS>,
+    FeatureTemplate<29, ALWAYS, MID_POS, DEP_WORD>
+> SiblingTemplateList;
+
+template<class Sink>
+static void generate_head_feature(const TokenFeatureHash *ti, int dir_dist, 
+                                  Sink *sink)
+{
+    TemplateToken t = {ti, NULL, NULL};
+    
+    HeadTemplateList::emit(t, dir_dist, sink);
+    
+    return;
+}
+
+template<class Sink>
+static void generate_dependent_feature(const TokenFeatureHash *tj, 
+                                       int dir_dist, Sink *sink)
+{
+    TemplateToken t = {NULL, tj, NULL};
+    
+    DependentTemplateList::emit(t, dir_dist, sink);
+    
+    return;
+}
+
+template<class Sink>
+static void generate_bigram_feature(const TokenFeatureHash *ti, 
+                                    const TokenFeatureHash *tj,
+                                    int dir_dist, Sink *sink)
+{
+    TemplateToken t = {ti, tj, NULL};
+    
+    BigramTemplateList::emit(t, dir_dist, sink);
+    
+    return;
+}
+
+// token_hash points to the whole sentence
+template<class Sink>
+static void generate_in_between_feature(const TokenFeatureHash *token_hash,
+                                        int head_index, int dep_index,
+                                        int dir_dist, Sink *sink)
+{
+    TemplateToken t = {&token_hash[head_index], &token_hash[dep_index], NULL};
+    int start_index = head_index > dep_index ? dep_index : head_index;
+    
+    for(int i = start_index;i < dep_index;i++)
+    {
+        t.mid = &token_hash[i];
+        InBetweenTemplate::emit(t, dir_dist, sink);
+    }
+    
+    return;
+}
+
+template<class Sink>
+static void generate_surrounding_feature(const TokenFeatureHash *ti, 
+                                         const TokenFeatureHash *tj,
+                                         int dir_dist, Sink *sink)
+{
+    TemplateToken t = {ti, tj, NULL};
+    
+    SurroundingTemplateList::emit(t, dir_dist, sink);
+    
+    return;
+}
+
+// Templates that see both the head and the dependent
+template<class Sink>
+static void generate_pair_feature(const TokenFeatureHash *token_hash,
+                                  int head_index, int dep_index, 
+                                  int dir_dist, Sink *sink)
+{
+    const TokenFeatureHash *ti = &token_hash[head_index];
+    const TokenFeatureHash *tj = &token_hash[dep_index];
+    
+    generate_bigram_feature(ti, tj, dir_dist, sink);
+    generate_in_between_feature(token_hash, head_index, dep_index, dir_dist,
+                                sink);
+    generate_surrounding_feature(ti, tj, dir_dist, sink);
+    
+    return;
+}
+
+template<class Sink>
+static void generate_first_order_feature(const TokenFeatureHash *token_hash,
+                                         int head_index, int dep_index, 
+                                         Sink *sink)
+{
+    int dir_dist = get_dir_and_dist(head_index, dep_index);
+    
+    generate_head_feature(&token_hash[head_index], dir_dist, sink);
+    generate_dependent_feature(&token_hash[dep_index], dir_dist, sink);
+    generate_pair_feature(token_hash, head_index, dep_index, dir_dist, sink);
+    
+    return;
+}
+
+// Same, without in-between features, so a fixed number of templates per 
+// arc. score_first_order_batch() takes those from in_between_score_list
+template<class Sink>
+static void generate_local_feature(const TokenFeatureHash *token_hash,
+                                   int head_index, int dep_index, Sink *sink)
+{
+    const TokenFeatureHash *ti = &token_hash[head_index];
+    const TokenFeatureHash *tj = &token_hash[dep_index];
+    int dir_dist = get_dir_and_dist(head_index, dep_index);
+    
+    generate_head_feature(ti, dir_dist, sink);
+    generate_dependent_feature(tj, dir_dist, sink);
+    generate_bigram_feature(ti, tj, dir_dist, sink);
+    generate_surrounding_feature(ti, tj, dir_dist, sink);
+    
+    return;
+}
+
+// Sums up weights of all features
+struct ScoreSink
+{
+    float score;
+    
+    ScoreSink() { score = 0.0; }
+    void add(unsigned long h, unsigned long type) { score += get_weight(h); }
+};
+
+// Same, over quantized_model
+struct QuantizedScoreSink
+{
+    float score;
+    
+    QuantizedScoreSink() { score = 0.0; }
+    void add(unsigned long h, unsigned long type) 
+    { 
+        score += get_quantized_weight(&quantized_model, h, type); 
+    }
+};
+
+// Same, plus the weights in a delta table
+struct DeltaScoreSink
+{
+    float score;
+    const WeightTable *delta_table;
+    
+    DeltaScoreSink(const WeightTable *table) 
+    { 
+        score = 0.0; 
+        delta_table = table; 
+    }
+    void add(unsigned long h, unsigned long type) 
+    { 
+        score += get_weight(h) + get_table_weight(delta_table, h); 
+    }
+};
+
+// Writes features, and their types if type_list is not NULL, into caller
+// owned arrays
+struct BufferSink
+{
+    unsigned long *hash_list;
+    unsigned short *type_list;
+    int size;
+    int capacity;
+    
+    BufferSink(unsigned long *phash_list, unsigned short *ptype_list, 
+               int pcapacity) 
+    { 
+        hash_list = phash_list; 
+        type_list = ptype_list;
+        size = 0;
+        capacity = pcapacity; 
+    }
+    void add(unsigned long h, unsigned long type) 
+    { 
+        if(size == capacity) 
+            ERROR("Feature buffer of %d features is too small", capacity);
+        
+        if(type_list != NULL) type_list[size] = type;
+        hash_list[size++] = h; 
+    }
+};
+
+// Sums the plain and the packed features apart. Every emit_feature() adds
+// the plain feature, then the one packed with dir_dist. The plain one does
+// not depend on dir_dist, so it is only looked up if with_plain is set
+struct SplitScoreSink
+{
+    float plain;
+    float packed;
+    bool with_plain;
+    int add_num;
+    const WeightTable *delta_table;
+    
+    SplitScoreSink(const WeightTable *table, bool pwith_plain) 
+    { 
+        plain = packed = 0.0;
+        with_plain = pwith_plain;
+        add_num = 0;
+        delta_table = table;
+    }
+    void add(unsigned long h, unsigned long type) 
+    { 
+        bool is_plain = add_num++ % 2 == 0;
+        if(is_plain && !with_plain) return;
+        
+        float weight = get_weight(h);
+        if(delta_table != NULL) weight += get_table_weight(delta_table, h);
+        
+        if(is_plain) plain += weight;
+        else packed += weight;
+    }
+};
+
+float get_first_order_feature_score(ParserContext *pc, Sentence *sent, 
+                                    int head_index, int dep_index)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    if(pc->delta_table != NULL)
+    {
+        DeltaScoreSink sink(pc->delta_table);
+        generate_first_order_feature(&pc->token_hash_list[0], head_index, 
+                                     dep_index, &sink);
+        
+        return sink.score;
+    }
+    
+    ScoreSink sink;
+    generate_first_order_feature(&pc->token_hash_list[0], head_index, 
+                                 dep_index, &sink);
+    
+    return sink.score;
+}
+
+// Same as get_first_order_feature_score(), with quantized weights. Set 
+// arc_scorer to quantized_scorer to decode with quantized_model
+float get_quantized_feature_score(ParserContext *pc, Sentence *sent, 
+                                  int head_index, int dep_index)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    QuantizedScoreSink sink;
+    generate_first_order_feature(&pc->token_hash_list[0], head_index, 
+                                 dep_index, &sink);
+    
+    return sink.score;
+}
+
+const ArcScorer quantized_scorer = {NULL, get_quantized_feature_score, NULL};
+
+// Write hashes of all features of the arc into hash_list, and their 
+// types into type_list unless it is NULL, in the order they are scored.
+// Returns how many there are. Nothing is allocated
+// MAX_FIRST_ORDER_FEATURE_NUM(sent->length) is always enough capacity
+int extract_first_order_feature(ParserContext *pc, Sentence *sent, 
+                                int head_index, int dep_index, 
+                                unsigned long *hash_list, 
+                                unsigned short *type_list, int capacity)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    BufferSink sink(hash_list, type_list, capacity);
+    generate_first_order_feature(&pc->token_hash_list[0], head_index, 
+                                 dep_index, &sink);
+    
+    return sink.size;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Batched scoring
+//
+// ScoreSink looks every weight up as soon as the feature is hashed, so on
+// a large model the core waits on a cache miss for most of the ~80 
+// features of an arc, one at a time. score_first_order_batch() hashes all
+// features of a block of arcs into a buffer first, then sums their 
+// weights while prefetching the slot of the feature 
+// BATCH_PREFETCH_DISTANCE ahead, so that many misses are in flight at 
+// once. In-between features, O(n) per arc, are not generated but taken 
+// from precompute_in_between_score(), so that scoring a sentence is 
+// O(n^2). Scores are those of get_first_order_feature_score() up to float 
+// rounding
+
+// Write the scores of arcs (head_index, dep_list[k]) into score_list[k]
+void score_first_order_batch(ParserContext *pc, Sentence *sent, 
+                             int head_index, const int *dep_list, int arc_num,
+                             float *score_list, ScoreBatch *batch)
+{
+    if(SentenceKey(sent) != pc->in_between_key) 
+        precompute_in_between_score(pc, sent);
+    
+    int n = sent->length;
+    int arc_capacity = MAX_FIRST_ORDER_FEATURE_NUM(0);
+    if(batch->hash_list.size() < (size_t)arc_num * arc_capacity)
+        batch->hash_list.resize((size_t)arc_num * arc_capacity);
+    if((int)batch->offset_list.size() < arc_num + 1) 
+        batch->offset_list.resize(arc_num + 1);
+    
+    unsigned long *hash_list = &batch->hash_list[0];
+    int *offset_list = &batch->offset_list[0];
+    int feature_num = 0;
+    
+    for(int k = 0;k < arc_num;k++)
+    {
+        BufferSink sink(hash_list + feature_num, NULL, arc_capacity);
+        generate_local_feature(&pc->token_hash_list[0], head_index, 
+                               dep_list[k], &sink);
+        
+        offset_list[k] = feature_num;
+        feature_num += sink.size;
+    }
+    offset_list[arc_num] = feature_num;
+    
+    const WeightTable *delta_table = pc->delta_table;
+    for(int i = 0;i < BATCH_PREFETCH_DISTANCE && i < feature_num;i++)
+    {
+        prefetch_weight(hash_list[i]);
+        if(delta_table != NULL) prefetch_table_weight(delta_table, hash_list[i]);
+    }
+    
+    const float *in_between_row = &pc->in_between_score_list[head_index * n];
+    for(int k = 0;k < arc_num;k++)
+    {
+        float score = head_index < dep_list[k] ? in_between_row[dep_list[k]] 
+                                               : 0.0;
+        
+        for(int i = offset_list[k];i < offset_list[k + 1];i++)
+        {
+            if(i + BATCH_PREFETCH_DISTANCE < feature_num)
+            {
+                unsigned long ahead = hash_list[i + BATCH_PREFETCH_DISTANCE];
+                
+                prefetch_weight(ahead);
+                if(delta_table != NULL) prefetch_table_weight(delta_table, ahead);
+            }
+            
+            // Same expressions as ScoreSink and DeltaScoreSink
+            if(delta_table != NULL) 
+                score += get_weight(hash_list[i]) + 
+                         get_table_weight(delta_table, hash_list[i]);
+            else score += get_weight(hash_list[i]);
+        }
+        
+        score_list[k] = score;
+    }
+    
+    return;
+}
+
+// score_arcs() calls this on every sentence, so in-between sums are
+// computed again on a sentence scored before with other weights
+static void prepare_first_order_score(ParserContext *pc, Sentence *sent)
+{
+    precompute_in_between_score(pc, sent);
+    
+    return;
+}
+
+// The default scorer
+const ArcScorer first_order_scorer = {
+    prepare_first_order_score, get_first_order_feature_score, 
+    score_first_order_batch
+};
+
+///////////////////////////////////////////////////////////////////////
+// In-between features from prefix counts
+//
+// generate_in_between_feature() emits one type 12 feature per position i
+// in [head, dep), which only fires for head < dep, so scoring every arc
+// that way takes O(n^3) lookups. The feature depends on i only through
+// the POS of i, so with cnt(p, k), the number of tokens before k whose POS
+// is p, the sum is
+//   sum over POS p of (cnt(p, dep) - cnt(p, head)) * w(pos_head, p, pos_dep)
+// where w is the plain plus the packed weight of the feature. Arcs are 
+// taken in order of (pos_head, pos_dep, dir_dist), so that every w is 
+// looked up once per such group. That is O(n^2) lookups at most, since 
+// a sentence only has a few distinct POS tags, and O(n^2 * #POS) 
+// additions, as spans shorter than #POS are summed token by token. Sums
+// are the same as with the generator up to float rounding
+
+// Plain plus packed weight of one in-between feature
+inline float get_in_between_weight(ParserContext *pc, const TemplateToken &t,
+                                   int dir_dist)
+{
+    SplitScoreSink sink(pc->delta_table, true);
+    
+    InBetweenTemplate::emit(t, dir_dist, &sink);
+    
+    return sink.plain + sink.packed;
+}
+
+// Fills pc->in_between_score_list[head * n + dep] for head < dep. Returns
+// the number of weights looked up
+int precompute_in_between_score(ParserContext *pc, Sentence *sent)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    int n = sent->length;
+    // First token of every distinct POS
+    vector<const TokenFeatureHash *> pos_token_list;
+    vector<int> pos_index(n);
+    
+    for(int i = 0;i < n;i++)
+    {
+        const TokenHash *pos = &pc->token_hash_list[i].pos;
+        int p = 0;
+        
+        while(p < (int)pos_token_list.size() && 
+              (pos_token_list[p]->pos.hash != pos->hash || 
+               pos_token_list[p]->pos.power != pos->power)) p++;
+        if(p == (int)pos_token_list.size()) 
+            pos_token_list.push_back(&pc->token_hash_list[i]);
+        pos_index[i] = p;
+    }
+    
+    int pos_num = pos_token_list.size();
+    vector<int> count_list((size_t)(n + 1) * pos_num, 0);
+    for(int i = 0;i < n;i++)
+    {
+        copy(&count_list[i * pos_num], &count_list[(i + 1) * pos_num], 
+             &count_list[(i + 1) * pos_num]);
+        count_list[(i + 1) * pos_num + pos_index[i]]++;
+    }
+    
+    // (pos_head, pos_dep, dir_dist) in the high bits, the arc in the low
+    vector<uint64_t> arc_list;
+    arc_list.reserve((size_t)n * (n - 1) / 2);
+    for(int head = 0;head < n;head++)
+    {
+        for(int dep = head + 1;dep < n;dep++)
+        {
+            uint64_t group = ((uint64_t)pos_index[head] * pos_num + 
+                              pos_index[dep]) * DIR_DIST_NUM + 
+                             get_dir_and_dist(head, dep);
+            arc_list.push_back(group << 32 | (uint64_t)head << 16 | dep);
+        }
+    }
+    sort(arc_list.begin(), arc_list.end());
+    
+    vector<float> weight_list(pos_num);
+    vector<char> known_list(pos_num);
+    uint64_t current_group = ~(uint64_t)0;
+    int lookup_num = 0;
+    
+    pc->in_between_score_list.resize((size_t)n * n);
+    for(int i = 0;i < (int)arc_list.size();i++)
+    {
+        uint64_t group = arc_list[i] >> 32;
+        int head = (arc_list[i] >> 16) & 0xFFFF, dep = arc_list[i] & 0xFFFF;
+        int dir_dist = get_dir_and_dist(head, dep);
+        TemplateToken t = {&pc->token_hash_list[head], 
+                           &pc->token_hash_list[dep], NULL};
+        const int *head_count = &count_list[head * pos_num];
+        const int *dep_count = &count_list[dep * pos_num];
+        float score = 0.0;
+        
+        if(group != current_group)
+        {
+            fill(known_list.begin(), known_list.end(), 0);
+            current_group = group;
+        }
+        
+        // Short spans are summed token by token, long ones by POS
+        if(dep - head <= pos_num)
+        {
+            for(int k = head;k < dep;k++)
+            {
+                int p = pos_index[k];
+                if(!known_list[p]) 
+                {
+                    t.mid = pos_token_list[p];
+                    weight_list[p] = get_in_between_weight(pc, t, dir_dist);
+                    known_list[p] = 1;
+                    lookup_num += 2;
+                }
+                score += weight_list[p];
+            }
+        }
+        else
+        {
+            for(int p = 0;p < pos_num;p++)
+            {
+                int num = dep_count[p] - head_count[p];
+                if(num == 0) continue;
+                
+                if(!known_list[p]) 
+                {
+                    t.mid = pos_token_list[p];
+                    weight_list[p] = get_in_between_weight(pc, t, dir_dist);
+                    known_list[p] = 1;
+                    lookup_num += 2;
+                }
+                score += num * weight_list[p];
+            }
+        }
+        
+        pc->in_between_score_list[head * n + dep] = score;
+    }
+    
+    pc->in_between_key = SentenceKey(sent);
+    
+    return lookup_num;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Factorized scoring
+//
+// Head templates (types 0-2) only see the head and dir_dist, dependent 
+// templates (types 3-5) only the dependent and dir_dist. Their sums are
+// computed once per sentence for every token and dir_dist bucket it could
+// have, so that get_factorized_feature_score() only generates the pair 
+// templates for every arc. In-between features come from 
+// precompute_in_between_score(). Scores are those of 
+// get_first_order_feature_score() up to float rounding, as additions are
+// grouped differently. Set arc_scorer to factorized_scorer to decode and
+// train with it
+
+// Smallest distance of every bucket of get_dir_and_dist()
+static const int bucket_min_dist[] = {0, 1, 2, 3, 4, 5, 10};
+
+// Fill score_list[dir_dist] for the dir_dist buckets token i could have 
+// as a head (is_head) or as a dependent. Returns the number of weights 
+// looked up
+template<bool is_head>
+static int precompute_token_score(const TokenFeatureHash *th, int i, int n,
+                                  const WeightTable *delta_table, 
+                                  float *score_list)
+{
+    float plain = 0.0;
+    bool with_plain = true;
+    int lookup_num = 0;
+    
+    for(int dir = 0;dir < 2;dir++)
+    {
+        // dir 1 is head on the left
+        int max_dist = (dir == 1) == is_head ? n - 1 - i : i;
+        
+        for(int dist = 1;dist <= 6 && bucket_min_dist[dist] <= max_dist;dist++)
+        {
+            int dir_dist = (dist << 1) | dir;
+            SplitScoreSink sink(delta_table, with_plain);
+            
+            if(is_head) generate_head_feature(th, dir_dist, &sink);
+            else generate_dependent_feature(th, dir_dist, &sink);
+            
+            if(with_plain) plain = sink.plain;
+            lookup_num += with_plain ? sink.add_num : sink.add_num / 2;
+            with_plain = false;
+            
+            score_list[dir_dist] = plain + sink.packed;
+        }
+    }
+    
+    return lookup_num;
+}
+
+// Called by get_factorized_feature_score() when it sees a new sentence,
+// and by score_arcs() before scoring in parallel. Returns the number of 
+// weights looked up
+int precompute_factorized_score(ParserContext *pc, Sentence *sent)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    int n = sent->length;
+    int lookup_num = 0;
+    
+    pc->head_score_list.resize(n * DIR_DIST_NUM);
+    pc->dep_score_list.resize(n * DIR_DIST_NUM);
+    for(int i = 0;i < n;i++)
+    {
+        const TokenFeatureHash *th = &pc->token_hash_list[i];
+        
+        lookup_num += precompute_token_score<true>(
+            th, i, n, pc->delta_table, &pc->head_score_list[i * DIR_DIST_NUM]);
+        if(i > 0)
+            lookup_num += precompute_token_score<false>(
+                th, i, n, pc->delta_table, &pc->dep_score_list[i * DIR_DIST_NUM]);
+    }
+    
+    lookup_num += precompute_in_between_score(pc, sent);
+    pc->factorized_key = SentenceKey(sent);
+    
+    return lookup_num;
+}
+
+float get_factorized_feature_score(ParserContext *pc, Sentence *sent, 
+                                   int head_index, int dep_index)
+{
+    if(SentenceKey(sent) != pc->factorized_key) 
+        precompute_factorized_score(pc, sent);
+    
+    int n = sent->length;
+    int dir_dist = get_dir_and_dist(head_index, dep_index);
+    const TokenFeatureHash *ti = &pc->token_hash_list[head_index];
+    const TokenFeatureHash *tj = &pc->token_hash_list[dep_index];
+    float score = pc->head_score_list[head_index * DIR_DIST_NUM + dir_dist] +
+                  pc->dep_score_list[dep_index * DIR_DIST_NUM + dir_dist];
+    
+    if(head_index < dep_index) 
+        score += pc->in_between_score_list[head_index * n + dep_index];
+    
+    if(pc->delta_table != NULL)
+    {
+        DeltaScoreSink sink(pc->delta_table);
+        generate_bigram_feature(ti, tj, dir_dist, &sink);
+        generate_surrounding_feature(ti, tj, dir_dist, &sink);
+        
+        return score + sink.score;
+    }
+    
+    ScoreSink sink;
+    generate_bigram_feature(ti, tj, dir_dist, &sink);
+    generate_surrounding_feature(ti, tj, dir_dist, &sink);
+    
+    return score + sink.score;
+}
+
+// Sums are recomputed for every sentence score_arcs() is called on, even
+// one seen before, since weights may have changed since, e.g. in training
+static void prepare_factorized_score(ParserContext *pc, Sentence *sent)
+{
+    precompute_factorized_score(pc, sent);
+    
+    return;
+}
+
+const ArcScorer factorized_scorer = {
+    prepare_factorized_score, get_factorized_feature_score, NULL
+};
+
 ///////////////////////////////////////////////////////////////////////
 // Second order feature
+//
+// Sibling features (McDonald and Pereira, 2006) look at a head and two 
+// modifiers on the same side of it that are next to each other among its
+// children. sib is the one closer to the head, or the head itself if dep
+// is its first child on that side, in which case sib is taken to be _N_
+// Direction is that of the arc, and distance is between sib and dep
+
+template<class Sink>
+static void generate_sibling_feature(const TokenFeatureHash *token_hash,
+                                     int head_index, int sib_index, 
+                                     int dep_index, Sink *sink)
+{
+    TemplateToken t = {&token_hash[head_index], &token_hash[dep_index], 
+                       &token_hash[sib_index]};
+    TokenFeatureHash null_token;
+    int dir_dist;
+    
+    if(sib_index == head_index) 
+    {
+        null_token.word = null_token.pos = *get_token_hash(NULL_POS_ID);
+        null_token.five_gram_flag = false;
+        t.mid = &null_token;
+        dir_dist = get_dir_and_dist(head_index, dep_index);
+    }
+    else dir_dist = get_dir_and_dist(sib_index, dep_index);
+    
+    SiblingTemplateList::emit(t, dir_dist, sink);
+    
+    return;
+}
+
+// Score of the sibling part alone; the arc itself is scored by 
+// get_first_order_feature_score()
+float get_sibling_feature_score(ParserContext *pc, Sentence *sent, 
+                                int head_index, int sib_index, int dep_index)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    if(pc->delta_table != NULL)
+    {
+        DeltaScoreSink sink(pc->delta_table);
+        generate_sibling_feature(&pc->token_hash_list[0], head_index, 
+                                 sib_index, dep_index, &sink);
+        
+        return sink.score;
+    }
+    
+    ScoreSink sink;
+    generate_sibling_feature(&pc->token_hash_list[0], head_index, sib_index,
+                             dep_index, &sink);
+    
+    return sink.score;
+}
+
+// Same as get_sibling_feature_score(), with quantized weights. Set 
+// sibling_weight to this, along with arc_scorer to quantized_scorer, to
+// decode second order models with quantized_model
+float get_quantized_sibling_score(ParserContext *pc, Sentence *sent, 
+                                  int head_index, int sib_index, 
+                                  int dep_index)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    QuantizedScoreSink sink;
+    generate_sibling_feature(&pc->token_hash_list[0], head_index, sib_index,
+                             dep_index, &sink);
+    
+    return sink.score;
+}
+
+// Same as extract_first_order_feature(), for the sibling part. 
+// MAX_SIBLING_FEATURE_NUM is always enough capacity
+int extract_sibling_feature(ParserContext *pc, Sentence *sent, 
+                            int head_index, int sib_index, int dep_index, 
+                            unsigned long *hash_list, 
+                            unsigned short *type_list, int capacity)
+{
+    if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+    
+    BufferSink sink(hash_list, type_list, capacity);
+    generate_sibling_feature(&pc->token_hash_list[0], head_index, sib_index,
+                             dep_index, &sink);
+    
+    return sink.size;
+}
 
 ///////////////////////////////////////////////////////////////////////
 // Test code
 
+// Gives every feature emitted a random weight, at least 0.1 in magnitude
+struct RandomWeightSink
+{
+    void add(unsigned long h, unsigned long type) 
+    { 
+        float *weight = find_or_insert_weight(&weight_vector, h);
+        if(*weight == 0.0) 
+            *weight = (float)(rand() % 901 + 100) / 1000.0 * 
+                      (rand() % 2 ? 1.0 : -1.0);
+    }
+};
+
+// Give every first order feature of all arcs of the sentences a random 
+// weight, for tests and benchmarks that need a populated model. Callers 
+// clear weight_vector when they are done
+void add_random_weight(Sentence **sentence_list, int sentence_num)
+{
+    ParserContext pc;
+    RandomWeightSink sink;
+    
+    srand(0);
+    for(int i = 0;i < sentence_num;i++)
+    {
+        Sentence *sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    generate_first_order_feature(&pc.token_hash_list[0], 
+                                                 head, dep, &sink);
+    }
+    
+    return;
+}
+
+// Check that the precomputed path gives the same hash values as the 
+// string based one. Every feature of the precomputed path is given a 
+// random weight, so any differing hash value would change the score of
+// the reference by at least 0.1. Scores are compared with a small 
+// tolerance, since the two paths do not group the additions the same way
+// Returns the number of arcs whose scores differ
+int test_feature_hash(int max_sentence_num)
+{
+    Context ctx;
+    ParserContext pc;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    while((int)sentence_list.size() < max_sentence_num && 
+          (sent = get_next_sentence(&ctx)) != NULL)
+    {
+        sentence_list.push_back(sent);
+    }
+    
+    clear_weight_table(&weight_vector);
+    add_random_weight(&sentence_list[0], sentence_list.size());
+    
+    vector<float> expected_list;
+    double start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    expected_list.push_back(
+                        get_first_order_feature_score_reference(sent, head, dep));
+    }
+    double reference_time = get_wall_time() - start_time;
+    
+    int arc_num = 0, mismatch = 0;
+    start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = 1;dep < sent->length;dep++)
+            {
+                if(head == dep) continue;
+                
+                float score = get_first_order_feature_score(&pc, sent, head, 
+                                                            dep);
+                if(fabs(score - expected_list[arc_num]) > 1e-3) mismatch++;
+                arc_num++;
+            }
+        }
+    }
+    double precomputed_time = get_wall_time() - start_time;
+    
+    // Extracted vectors must score exactly the same, as the additions are
+    // done in the same order
+    vector<unsigned long> hash_list;
+    long feature_num = 0;
+    start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        hash_list.resize(MAX_FIRST_ORDER_FEATURE_NUM(sent->length));
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = 1;dep < sent->length;dep++)
+            {
+                if(head == dep) continue;
+                
+                int num = extract_first_order_feature(&pc, sent, head, dep, 
+                                                      &hash_list[0], NULL,
+                                                      hash_list.size());
+                if(dot_feature_vector(&weight_vector, &hash_list[0], num) != 
+                   get_first_order_feature_score(&pc, sent, head, dep))
+                    mismatch++;
+                feature_num += num;
+            }
+        }
+    }
+    double extract_time = get_wall_time() - start_time;
+    
+    DEBUG("Feature hash: %d arcs, %lu features, mismatch = %d\n"
+          "string hashing %.3f s, precomputed %.3f s, extract + dot + "
+          "score %.3f s (%.1f features/arc)", arc_num, 
+          weight_vector.size, mismatch, 
+          reference_time, precomputed_time, extract_time, 
+          (double)feature_num / arc_num);
+    clear_weight_table(&weight_vector);
+    
+    return mismatch;
+}
+
+// Counts the features emitted
+struct CountSink
+{
+    long num;
+    
+    CountSink() { num = 0; }
+    void add(unsigned long h, unsigned long type) { num++; }
+};
+
+// Compare get_factorized_feature_score() with 
+// get_first_order_feature_score() on every arc of the first 
+// max_sentence_num sentences, with random weights for all features, and 
+// report the time and the number of weights looked up of both
+// Returns the number of arcs whose scores differ
+int test_factorized_score(int max_sentence_num)
+{
+    Context ctx;
+    ParserContext pc;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    while((int)sentence_list.size() < max_sentence_num && 
+          (sent = get_next_sentence(&ctx)) != NULL)
+    {
+        sentence_list.push_back(sent);
+    }
+    
+    srand(0);
+    clear_weight_table(&weight_vector);
+    long full_lookup_num = 0, factorized_lookup_num = 0;
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        RandomWeightSink sink;
+        CountSink count_sink, pair_count_sink;
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = 1;dep < sent->length;dep++)
+            {
+                if(head == dep) continue;
+                
+                generate_first_order_feature(&pc.token_hash_list[0], head, 
+                                             dep, &sink);
+                generate_first_order_feature(&pc.token_hash_list[0], head, 
+                                             dep, &count_sink);
+                generate_bigram_feature(&pc.token_hash_list[head], 
+                                        &pc.token_hash_list[dep], 
+                                        get_dir_and_dist(head, dep), 
+                                        &pair_count_sink);
+                generate_surrounding_feature(&pc.token_hash_list[head], 
+                                             &pc.token_hash_list[dep], 
+                                             get_dir_and_dist(head, dep), 
+                                             &pair_count_sink);
+            }
+        }
+        full_lookup_num += count_sink.num;
+        factorized_lookup_num += pair_count_sink.num + 
+                                 precompute_factorized_score(&pc, sent);
+    }
+    
+    vector<float> expected_list;
+    double start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    expected_list.push_back(
+                        get_first_order_feature_score(&pc, sent, head, dep));
+    }
+    double full_time = get_wall_time() - start_time;
+    
+    int arc_num = 0, mismatch = 0;
+    float max_diff = 0.0;
+    start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = 1;dep < sent->length;dep++)
+            {
+                if(head == dep) continue;
+                
+                float score = get_factorized_feature_score(&pc, sent, head, 
+                                                           dep);
+                float diff = fabs(score - expected_list[arc_num]);
+                if(diff > 1e-3) mismatch++;
+                if(diff > max_diff) max_diff = diff;
+                arc_num++;
+            }
+        }
+    }
+    double factorized_time = get_wall_time() - start_time;
+    
+    DEBUG("Factorized score: %d arcs, mismatch = %d (max diff %g)\n"
+          "full %.3f s, %.1f lookups/arc, factorized %.3f s, %.1f lookups/arc"
+          " (x%.2f)", arc_num, mismatch, max_diff, full_time, 
+          (double)full_lookup_num / arc_num, factorized_time, 
+          (double)factorized_lookup_num / arc_num, full_time / factorized_time);
+    clear_weight_table(&weight_vector);
+    
+    return mismatch;
+}
+
+// Compare precompute_in_between_score() with get_in_between_feature_score()
+// on every arc of the first max_sentence_num sentences, with random 
+// weights for all features, and report the time and the number of 
+// weights looked up of both. Returns the number of arcs that differ
+int test_in_between_score(int max_sentence_num)
+{
+    Context ctx;
+    ParserContext pc;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    while((int)sentence_list.size() < max_sentence_num && 
+          (sent = get_next_sentence(&ctx)) != NULL)
+    {
+        sentence_list.push_back(sent);
+    }
+    
+    srand(0);
+    clear_weight_table(&weight_vector);
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        RandomWeightSink sink;
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    generate_first_order_feature(&pc.token_hash_list[0], 
+                                                 head, dep, &sink);
+    }
+    
+    // The generator, on precomputed hashes, is what scoring does now
+    vector<float> expected_list;
+    long feature_num = 0;
+    double start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = head + 1;dep < sent->length;dep++)
+            {
+                ScoreSink sink;
+                generate_in_between_feature(&pc.token_hash_list[0], head, dep,
+                                            get_dir_and_dist(head, dep), 
+                                            &sink);
+                expected_list.push_back(sink.score);
+                feature_num += 2 * (dep - head);
+            }
+        }
+    }
+    double generator_time = get_wall_time() - start_time;
+    
+    long lookup_num = 0;
+    start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        lookup_num += precompute_in_between_score(&pc, sent);
+    }
+    double prefix_time = get_wall_time() - start_time;
+    
+    int arc_num = 0, mismatch = 0;
+    float max_diff = 0.0;
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_in_between_score(&pc, sent);
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            for(int dep = 1;dep < sent->length;dep++)
+            {
+                if(head == dep) continue;
+                
+                float expected = get_in_between_feature_score(sent, head, dep);
+                float score = head < dep ? 
+                    pc.in_between_score_list[head * sent->length + dep] : 0.0;
+                float diff = fabs(score - expected);
+                
+                if(diff > 1e-3) mismatch++;
+                if(diff > max_diff) max_diff = diff;
+                if(head < dep && expected != expected_list[arc_num++]) 
+                    mismatch++;
+            }
+        }
+    }
+    
+    DEBUG("In-between score: %d arcs, mismatch = %d (max diff %g)\n"
+          "generator %.3f s, %ld lookups, prefix counts %.3f s, %ld lookups"
+          " (x%.2f)", arc_num, mismatch, max_diff, generator_time, 
+          feature_num, prefix_time, lookup_num, generator_time / prefix_time);
+    clear_weight_table(&weight_vector);
+    
+    return mismatch;
+}
+
+// Score every arc of the first max_sentence_num sentences one at a time
+// and in batches of one head each, on a model with a random weight for 
+// every feature of them. In-between features are summed in another order
+// in batches, so scores are compared with a small tolerance; a feature 
+// missed or added would change a score by at least 0.1. Returns the 
+// number of arcs that differ
+int test_batch_score(int max_sentence_num)
+{
+    Context ctx;
+    ParserContext pc;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    while((int)sentence_list.size() < max_sentence_num && 
+          (sent = get_next_sentence(&ctx)) != NULL)
+    {
+        sentence_list.push_back(sent);
+    }
+    
+    srand(0);
+    clear_weight_table(&weight_vector);
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        precompute_sentence_hash(&pc, sent);
+        
+        RandomWeightSink sink;
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    generate_first_order_feature(&pc.token_hash_list[0], 
+                                                 head, dep, &sink);
+    }
+    
+    vector<float> expected_list;
+    double start_time = get_wall_time();
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        
+        for(int head = 0;head < sent->length;head++)
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) 
+                    expected_list.push_back(
+                        get_first_order_feature_score(&pc, sent, head, dep));
+    }
+    double single_time = get_wall_time() - start_time;
+    
+    ScoreBatch batch;
+    vector<int> dep_list;
+    vector<float> score_list;
+    int arc_num = 0, mismatch = 0;
+    float max_diff = 0.0;
+    double batch_time = 0.0;
+    for(int i = 0;i < (int)sentence_list.size();i++)
+    {
+        sent = sentence_list[i];
+        
+        for(int head = 0;head < sent->length;head++)
+        {
+            dep_list.clear();
+            for(int dep = 1;dep < sent->length;dep++)
+                if(head != dep) dep_list.push_back(dep);
+            score_list.resize(dep_list.size());
+            
+            start_time = get_wall_time();
+            score_first_order_batch(&pc, sent, head, &dep_list[0], 
+                                    dep_list.size(), &score_list[0], &batch);
+            batch_time += get_wall_time() - start_time;
+            
+            for(size_t k = 0;k < dep_list.size();k++)
+            {
+                float diff = fabs(score_list[k] - expected_list[arc_num++]);
+                
+                if(diff > 1e-3) mismatch++;
+                if(diff > max_diff) max_diff = diff;
+            }
+        }
+    }
+    
+    DEBUG("Batch score: %d arcs, %lu features (%.0f MB table), mismatch = %d"
+          " (max diff %g)\none at a time %.3f s, batched %.3f s (x%.2f)", 
+          arc_num, weight_vector.size, 
+          weight_vector.capacity * sizeof(WeightEntry) / 1048576.0, mismatch,
+          max_diff, single_time, batch_time, single_time / batch_time);
+    clear_weight_table(&weight_vector);
+    
+    return mismatch;
+}
+
+// Multi-lane hash_feature(), only used by the benchmark in test(). It is
+// slower than hashing one feature at a time: in a loop over features, 
+// out-of-order execution already overlaps the multiply chains of 
+// consecutive hashes, and copying strings into lanes costs about as much
+// as hashing them. Kept so that the comparison could be rerun
+// Features hashed side by side, and characters taken at a time per lane
+#define HASH_LANE_NUM 4
+#define HASH_BLOCK_LENGTH 64
+
+// hash_feature() of HASH_LANE_NUM features at once, lane k being 
+// (type_list[k], num_list[k], str_ppp[k]). Lanes with num_list[k] == 0 
+// and no type are free to use for padding.
+// A single hash is a chain of multiplies, each waiting on the last one, 
+// so here the lanes are hashed side by side in SIMD registers. The 
+// strings of every lane are copied column-wise into a block, right 
+// aligned: leading zeros keep a hash at 0, so shorter lanes need no mask 
+// and all lanes step h = h * HASH_MULTIPLIER + c together. Arithmetic is 
+// mod 2^64 as in hash_feature(), so hashes are bit-identical
+static void hash_feature_lanes(const unsigned long *type_list, 
+                               const int *num_list, 
+                               const unsigned char **const *str_ppp, 
+                               unsigned long *h_list)
+{
+    const unsigned char *str_p[HASH_LANE_NUM];
+    int str_index[HASH_LANE_NUM];
+    int length_list[HASH_LANE_NUM];
+    int max_length = 0;
+    
+    for(int lane = 0;lane < HASH_LANE_NUM;lane++)
+    {
+        length_list[lane] = 0;
+        for(int i = 0;i < num_list[lane];i++) 
+            length_list[lane] += strlen((const char *)str_ppp[lane][i]);
+        
+        max_length = max(max_length, length_list[lane]);
+        str_index[lane] = 0;
+        str_p[lane] = num_list[lane] > 0 ? str_ppp[lane][0] : NULL;
+    }
+    
+    // Characters of column i, one 64 bit word per lane
+    uint64_t block[HASH_BLOCK_LENGTH][HASH_LANE_NUM] 
+        __attribute__((aligned(16)));
+    
+#ifdef HAVE_SSE2_HASH
+    const __m128i multiplier = _mm_set1_epi64x(HASH_MULTIPLIER);
+    __m128i h[HASH_LANE_NUM / 2];
+    
+    for(int k = 0;k < HASH_LANE_NUM / 2;k++) h[k] = _mm_setzero_si128();
+#else
+    unsigned long h[HASH_LANE_NUM] = {0};
+#endif
+    
+    for(int begin = 0;begin < max_length;begin += HASH_BLOCK_LENGTH)
+    {
+        int width = min(HASH_BLOCK_LENGTH, max_length - begin);
+        
+        memset(block, 0, width * sizeof(block[0]));
+        for(int lane = 0;lane < HASH_LANE_NUM;lane++)
+        {
+            for(int i = max(0, max_length - length_list[lane] - begin);
+                i < width;i++)
+            {
+                while(*str_p[lane] == '\0') 
+                    str_p[lane] = str_ppp[lane][++str_index[lane]];
+                
+                block[i][lane] = *str_p[lane]++;
+            }
+        }
+        
+        for(int i = 0;i < width;i++)
+        {
+#ifdef HAVE_SSE2_HASH
+            // HASH_MULTIPLIER fits in 32 bits, so h * HASH_MULTIPLIER is 
+            // low(h) * m + (high(h) * m << 32), mod 2^64
+            for(int k = 0;k < HASH_LANE_NUM / 2;k++)
+            {
+                __m128i low = _mm_mul_epu32(h[k], multiplier);
+                __m128i high = _mm_mul_epu32(_mm_srli_epi64(h[k], 32), 
+                                             multiplier);
+                __m128i c = _mm_load_si128((const __m128i *)&block[i][2 * k]);
+                
+                h[k] = _mm_add_epi64(_mm_add_epi64(low, 
+                                                   _mm_slli_epi64(high, 32)), c);
+            }
+#else
+            for(int lane = 0;lane < HASH_LANE_NUM;lane++)
+                h[lane] = h[lane] * HASH_MULTIPLIER + block[i][lane];
+#endif
+        }
+    }
+    
+#ifdef HAVE_SSE2_HASH
+    for(int k = 0;k < HASH_LANE_NUM / 2;k++)
+        _mm_storeu_si128((__m128i *)&block[0][2 * k], h[k]);
+    
+    for(int lane = 0;lane < HASH_LANE_NUM;lane++)
+        h_list[lane] = block[0][lane] * HASH_MULTIPLIER + type_list[lane];
+#else
+    for(int lane = 0;lane < HASH_LANE_NUM;lane++)
+        h_list[lane] = h[lane] * HASH_MULTIPLIER + type_list[lane];
+#endif
+    
+    return;
+}
+
+// hash_feature() of feature_num features, HASH_LANE_NUM at a time
+static void hash_feature_batch(int feature_num, 
+                               const unsigned long *type_list, 
+                               const int *num_list, 
+                               const unsigned char **const *str_ppp, 
+                               unsigned long *h_list)
+{
+    int i = 0;
+    
+    for(;i + HASH_LANE_NUM <= feature_num;i += HASH_LANE_NUM)
+        hash_feature_lanes(type_list + i, num_list + i, str_ppp + i, 
+                           h_list + i);
+    
+    for(;i < feature_num;i++)
+        h_list[i] = hash_feature(type_list[i], num_list[i], 
+                                 (const unsigned char **)str_ppp[i]);
+    
+    return;
+}
+
+// Benchmarks hash_feature(), one hash at a time against HASH_LANE_NUM at
+// a time, over templates of one to three random tokens of the 
+// vocabulary. Returns the number of hashes that differ
 int test()
 {
-    const char *test_array[] = {"zxcvbnm", "asdfghjkl", "a", ""};
-    unsigned long h;
-    clock_t start = clock();
-    for(unsigned int i = 0;i < (unsigned int)1000000;i++)
+    const int feature_num = 1000000;
+    vector<const unsigned char *> str_list(feature_num * 3);
+    vector<const unsigned char **> str_pp_list(feature_num);
+    vector<unsigned long> type_list(feature_num);
+    vector<int> num_list(feature_num);
+    vector<unsigned long> expected_list(feature_num), h_list(feature_num);
+    
+    srand(0);
+    for(int i = 0;i < feature_num;i++)
     {
-        h = hash_feature(17, 1, (const unsigned char **)test_array + 2);
+        num_list[i] = 1 + rand() % 3;
+        type_list[i] = rand() % QUANT_TYPE_NUM;
+        str_pp_list[i] = &str_list[i * 3];
+        
+        for(int j = 0;j < num_list[i];j++)
+            str_list[i * 3 + j] = get_token_str(rand() % vocabulary.token_num);
     }
-    clock_t end = clock();
     
-    DEBUG("%f", (float)(end - start) / 1000000.0);
-    DEBUG("%ld, %lx", h, h);
+    double start_time = get_wall_time();
+    for(int i = 0;i < feature_num;i++)
+        expected_list[i] = hash_feature(type_list[i], num_list[i], 
+                                        str_pp_list[i]);
+    double scalar_time = get_wall_time() - start_time;
+    
+    start_time = get_wall_time();
+    hash_feature_batch(feature_num, &type_list[0], &num_list[0], 
+                       (const unsigned char **const *)&str_pp_list[0], 
+                       &h_list[0]);
+    double lane_time = get_wall_time() - start_time;
+    
+    int mismatch = 0;
+    for(int i = 0;i < feature_num;i++) 
+        if(h_list[i] != expected_list[i]) mismatch++;
+    
+    DEBUG("Hash %d features: scalar %.3f s, %d lanes %.3f s (x%.2f), "
+          "mismatch = %d", feature_num, scalar_time, HASH_LANE_NUM, lane_time,
+          scalar_time / lane_time, mismatch);
     
-    return 0;
+    return mismatch;
 }
@@ -8,10 +8,27 @@
 #include <time.h>
 
 #include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <string.h>
 #include <string>
 #include <unordered_map>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 using namespace std;
@@ -46,12 +63,70 @@ using namespace std;
 
 // Initial eisner matrix size
 #define INIT_SENTENCE_LEN 100
-#define MAX_EDGE_LIST_SIZE 200
 
-struct EisnerNode
+// Default sentence length from which a ParserContext with a score_pool 
+// scores arcs in parallel, and the number of heads in a task
+#define PARALLEL_SCORE_MIN_LENGTH 50
+#define PARALLEL_SCORE_HEAD_NUM 4
+
+// Number of first order templates, not counting in-between ones. Each
+// template fires one feature with and one without direction and distance
+#define FIRST_ORDER_TEMPLATE_NUM 35
+// At most one in-between template fires per token
+#define MAX_FIRST_ORDER_FEATURE_NUM(length) \
+    (2 * (FIRST_ORDER_TEMPLATE_NUM + (length)))
+// Number of sibling templates, and features of one sibling part
+#define SIBLING_TEMPLATE_NUM 5
+#define MAX_SIBLING_FEATURE_NUM (2 * SIBLING_TEMPLATE_NUM)
+
+// Eisner chart. There are four n x n planes, one for every (orientation,
+// shape), in a single allocation. Only spans s <= t are used, so the score
+// of (s, t) is mirrored into (t, s) of the same plane. The inner q loops 
+// could then read both e[s][q] and e[q][t] along a row
+// orientation: 1 = head on the left, 0 = head on the right
+// shape: 0 = complete (triangle), 1 = incomplete (trapezoid)
+#define CHART_ALIGN 64
+#define CHART_ALIGN_FLOAT (CHART_ALIGN / sizeof(float))
+
+struct EisnerChart
+{
+    int n;              // Capacity in tokens
+    int stride;         // Row length, n rounded up to CHART_ALIGN bytes
+    float *score;       // [orientation * 2 + shape][n][stride]
+    int *mid_index;     // Same layout, not mirrored
+    float *arc_score;   // [head][stride], filled by score_arcs()
+    void *block;        // The allocation holding all three
+    
+    EisnerChart() 
+    { 
+        n = stride = 0; 
+        score = NULL; mid_index = NULL; arc_score = NULL; block = NULL; 
+    }
+};
+
+// Chart of the second order sibling decoder, see parser.c. Item tables
+// are n x n and mirrored like EisnerChart, so that inner loops read both 
+// operands along rows. Tables are indexed [s * n + t]
+#define SIBLING_CHART_RIGHT 1      // Head on the left, as orientation
+#define SIBLING_CHART_LEFT 0
+
+struct SiblingChart
 {
-	float score;
-	int mid_index;	
+    int n;                              // Capacity in tokens
+    vector<float> complete[2];          // [orientation]
+    vector<float> incomplete[2];
+    vector<float> sibling;              // Two adjacent modifiers, see S()
+    vector<int> complete_mid[2];        // Not mirrored
+    vector<int> incomplete_mid[2];
+    vector<int> sibling_mid;
+    
+    // Arc plus sibling score of every (head, sib, dep). Row (head, dep) 
+    // starts at part_offset[head * n + dep] and has |head - dep| entries:
+    // [0] for the first child, [sib - min(head, dep)] for sib in between
+    vector<float> part_score;
+    vector<size_t> part_offset;
+    
+    SiblingChart() : n(0) {}
 };
 
 struct EdgeRecoveryNode
@@ -62,14 +137,16 @@ struct EdgeRecoveryNode
 	{
 		s = ps; t = pt; orientation = porientation; shape = pshape;
 	}
+	
+	EdgeRecoveryNode() {}
 };
 
-typedef EisnerNode *P_EisnerNode;
-typedef EisnerNode **PP_EisnerNode;
-
 
 // How many bits do we leave for type, dir and dist information
 #define HASH_MULTIPLIER 2897
+// Bump whenever feature hash values or their table slots change, so that
+// saved models are not read with a different hash
+#define FEATURE_HASH_VERSION 1
 
 struct Edge
 {
@@ -85,14 +162,66 @@ struct Edge
     Edge() {}
 };
 
+// Tokens are stored as IDs into the global vocabulary, one array per
+// field. The arrays are owned by the SectionFile the sentence comes from
 struct Sentence
 {
-    vector<string> word_list;
-    vector<string> pos_list;
-    vector<string> five_gram_word_list;
-    vector<bool> five_gram_flag;
+    int length;                             // Number of tokens, ROOT included
+    const unsigned int *word_list;
+    const unsigned int *pos_list;
+    const unsigned int *five_gram_word_list;
+    const unsigned char *five_gram_flag;
 
-    vector<Edge> gold_edge_list;
+    int gold_edge_num;                      // Always length - 1
+    const Edge *gold_edge_list;
+    
+    unsigned long generation;               // See sentence_generation
+    
+    // Empty, with arrays NULL and a generation of its own
+    Sentence();
+};
+
+// Incremented whenever the loader points sentences at new storage, e.g. 
+// a stream batch that may reuse the memory of a freed one. Sentences take 
+// the new value as their generation. Every Sentence() takes a new value 
+// too, so sentences built by hand never share a SentenceKey
+extern atomic<unsigned long> sentence_generation;
+
+// Identifies the sentence a ParserContext has hashed. The address alone 
+// is not enough, since sentences on the stack or in freed stream batches
+// come back at the same address with other tokens
+struct SentenceKey
+{
+    const Sentence *sent;
+    int length;
+    const unsigned int *word_list;
+    unsigned long generation;
+    
+    SentenceKey() { sent = NULL; length = 0; word_list = NULL; generation = 0; }
+    SentenceKey(const Sentence *psent) 
+    { 
+        sent = psent; 
+        length = psent->length; 
+        word_list = psent->word_list;
+        generation = psent->generation;
+    }
+    bool operator==(const SentenceKey &other) const
+    {
+        return sent == other.sent && length == other.length && 
+               word_list == other.word_list && generation == other.generation;
+    }
+    bool operator!=(const SentenceKey &other) const 
+    { 
+        return !(*this == other); 
+    }
+};
+
+// A token inside a file image. It is not '\0' terminated, since the
+// image may be a read-only mapping
+struct TokenView
+{
+    const char *str;
+    int len;
 };
 
 struct SectionFile
@@ -100,6 +229,15 @@ struct SectionFile
     string filename; // File name, no path
     
     vector<Sentence> sentence_list;
+    
+    // Storage of all sentences in this file, packed back to back
+    // Pointers in sentence_list point into these, so SectionFile must
+    // not be copied after it is loaded
+    vector<unsigned int> word_pool;
+    vector<unsigned int> pos_pool;
+    vector<unsigned int> five_gram_word_pool;
+    vector<unsigned char> five_gram_flag_pool;
+    vector<Edge> gold_edge_pool;
 };
 
 struct Section
@@ -128,6 +266,344 @@ struct Context
     }
 };
 
+// Binary corpus cache. All integers are in native byte order, and every
+// array starts at a multiple of 8 bytes so that it can be used in place
+// after the cache is mapped into memory
+#define CORPUS_CACHE_MAGIC 0x45484341434D4C47ULL   // "GLMCACHE"
+#define CORPUS_CACHE_VERSION 1
+
+struct CorpusCacheHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t section_num;
+    uint32_t file_num;
+    uint32_t sentence_num;
+    uint32_t vocab_num;
+    uint32_t padding;
+    uint64_t token_num;
+    uint64_t edge_num;
+    uint64_t text_size;
+    
+    // Byte offset of every array from the beginning of the cache
+    uint64_t section_offset;            // CorpusCacheSection[section_num]
+    uint64_t file_offset;               // CorpusCacheFile[file_num]
+    uint64_t sentence_offset;           // Length, uint32_t[sentence_num]
+    uint64_t word_offset;               // uint32_t[token_num]
+    uint64_t pos_offset;                // uint32_t[token_num]
+    uint64_t five_gram_word_offset;     // uint32_t[token_num]
+    uint64_t five_gram_flag_offset;     // unsigned char[token_num]
+    uint64_t gold_edge_offset;          // Edge[edge_num]
+    uint64_t vocab_offset;              // Into text, uint64_t[vocab_num + 1]
+    uint64_t text_offset;               // Tokens and file names
+};
+
+struct CorpusCacheSection
+{
+    int32_t section_id;
+    uint32_t file_num;
+};
+
+// Used to tell whether the source file has changed since it is cached
+struct CorpusCacheFile
+{
+    int64_t mtime;
+    int64_t size;
+    uint32_t name_offset;               // Into text, no path
+    uint32_t name_len;
+    uint32_t sentence_num;
+    uint32_t padding;
+};
+
+// Reserved token IDs. These are implied by every sentence
+#define ROOT_WORD_ID 0
+#define ROOT_POS_ID 1
+#define INVALID_WORD_ID 2       // Used when five gram does not exist
+#define NULL_POS_ID 3           // Used beyond the boundary of sentence
+#define RESERVED_TOKEN_NUM 4
+
+// Entries of the vocabulary are kept in chunks of doubling size, chunk k
+// holding IDs [2^(k + 8) - 2^8, 2^(k + 9) - 2^8). Entries never move once
+// they are interned, so the streaming loader could intern new tokens
+// while the parser is reading existing ones
+#define VOCAB_FIRST_CHUNK_BITS 8
+#define VOCAB_CHUNK_NUM 24
+
+// Polynomial hash of a token as computed by hash_feature(), and 
+// HASH_MULTIPLIER ^ (token length). The hash of a concatenation could
+// then be combined from token hashes, see hash_concat()
+struct TokenHash
+{
+    unsigned long hash;
+    unsigned long power;
+};
+
+struct VocabularyEntry
+{
+    string token;
+    TokenHash token_hash;
+};
+
+// Maps words, POS tags and five gram prefixes to dense IDs
+struct Vocabulary
+{
+    unordered_map<string, unsigned int> index;
+    unsigned int token_num;
+    VocabularyEntry *chunk_list[VOCAB_CHUNK_NUM];
+    
+    Vocabulary();
+    ~Vocabulary();
+    
+    // Chunks are owned by the instance
+    Vocabulary(const Vocabulary &) = delete;
+    Vocabulary &operator=(const Vocabulary &) = delete;
+};
+
+struct ThreadPool
+{
+    int thread_num;
+    vector<thread> thread_list;
+    
+    mutex lock;
+    condition_variable start_cv;    // Signaled when a new loop is posted
+    condition_variable finish_cv;   // Signaled when all workers are idle
+    
+    const function<void (int, int)> *current_task;
+    int task_num;
+    atomic<int> next_task;
+    int generation;                 // Number of loops posted so far
+    int busy_worker_num;
+    bool stopping;
+    
+    ThreadPool(int pthread_num);
+    ~ThreadPool();
+    
+    void run(int ptask_num, const function<void (int, int)> &task);
+    void execute_tasks(int worker_index);
+    void worker_loop(int worker_index);
+};
+
+// Everything a token contributes to first order features. Filled once
+// per sentence by precompute_sentence_hash()
+struct TokenFeatureHash
+{
+    TokenHash word;
+    TokenHash pos;
+    TokenHash five_gram_word;   // __INV__ if there is no five gram
+    TokenHash prev_pos;         // See get_surrounding_feature_score()
+    TokenHash next_pos;         // _N_ for the last token
+    bool five_gram_flag;
+};
+
+// Weight of one feature, stored inline in WeightTable
+struct WeightEntry
+{
+    unsigned long key;          // Feature hash, WEIGHT_EMPTY_KEY if unused
+    float weight;
+    // Type value hashed into key (see emit_feature()), recorded by 
+    // add_weight() for quantization. Where unsigned long is 64 bits it 
+    // takes what was padding, so entries stay 16 bytes; where it is 32 
+    // bits (e.g. Makefile.win, -m32) it grows entries from 8 to 12 bytes
+    unsigned int type;
+};
+
+// Open addressing hash table from feature hash to weight. Entries are kept
+// in one flat array of power of two size, and collisions are resolved by
+// linear probing, so a lookup usually touches a single cache line. Feature
+// hash 0 marks an empty slot, so its weight is kept outside the array
+#define WEIGHT_EMPTY_KEY 0UL
+#define WEIGHT_INIT_CAPACITY 1024
+// Grow when the table is more than half full
+#define WEIGHT_MAX_LOAD_FACTOR 0.5
+
+struct WeightTable
+{
+    WeightEntry *entry_list;
+    unsigned long capacity;
+    unsigned long mask;         // capacity - 1
+    int shift;                  // 64 - log2(capacity)
+    unsigned long size;         // Number of keys, including key 0
+    
+    bool has_empty_key;
+    float empty_key_weight;
+    
+    // Lazy averaging, only allocated by enable_weight_average(). Both are
+    // parallel to entry_list, plus slot [capacity] for WEIGHT_EMPTY_KEY
+    // sum_list[i] is the sum of the weight over all time steps before
+    // stamp_list[i], and becomes the average after finalize
+    double *sum_list;
+    unsigned int *stamp_list;
+    unsigned int average_time;  // Current time step, set by the caller
+    bool average_final;         // finalize_weight_average() has been called
+    bool use_average;           // Lookups return the averaged weights
+    
+    // Not NULL if entry_list points into a mapped model file, see 
+    // map_model(). The table is then read only
+    void *map_image;
+    size_t map_len;
+    
+    WeightTable();
+    ~WeightTable();
+};
+
+// Inference only quantized weights, see quantized_model.c. Every entry
+// keeps a 16-bit fingerprint of its key instead of the key, and a fp16 
+// or int8 value that is multiplied by the scale of its feature type
+#define QUANT_FP16 0
+#define QUANT_INT8 1
+#define QUANT_TYPE_NUM 512              // Types hashed into keys are < 30 << 4
+#define QUANT_MIN_CAPACITY 1024
+#define QUANT_MAX_LOAD_FACTOR 0.5
+
+struct QuantizedEntry
+{
+    uint16_t fingerprint;               // 0 if the slot is unused
+    uint16_t value;                     // fp16 bits, or int8 in the low byte
+};
+
+struct QuantizedModel
+{
+    int format;                         // QUANT_FP16 or QUANT_INT8
+    QuantizedEntry *entry_list;
+    unsigned long capacity;
+    unsigned long mask;
+    int shift;
+    unsigned long size;
+    
+    float empty_key_weight;             // Not quantized
+    float scale_list[QUANT_TYPE_NUM];
+    
+    QuantizedModel();
+    ~QuantizedModel();
+};
+
+// Count-min sketch, see count_sketch.c
+#define SKETCH_MAX_DEPTH 8
+#define SKETCH_DEPTH 4
+#define SKETCH_DEFAULT_SIZE (16UL << 20)    // Bytes
+
+struct CountSketch
+{
+    int depth;                  // Number of rows
+    unsigned long width;        // Counters per row, a power of two
+    int shift;                  // 64 - log2(width)
+    uint16_t *count_list;       // [depth][width], saturating
+    
+    CountSketch();
+    ~CountSketch();
+};
+
+// Binary model file: the entry array of a WeightTable as it is in memory,
+// so that a mapped file is probed in place with no loading at all
+#define MODEL_FILE_MAGIC 0x4C45444F4D4D4C47ULL     // "GLMMODEL"
+#define MODEL_FILE_VERSION 2                        // 2: WeightEntry::type
+
+struct ModelFileHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t hash_version;      // FEATURE_HASH_VERSION
+    uint32_t entry_size;        // sizeof(WeightEntry) of the writer
+    uint32_t has_empty_key;
+    float empty_key_weight;
+    uint32_t padding;
+    uint64_t capacity;          // Power of two
+    uint64_t size;
+    uint64_t entry_offset;      // WeightEntry[capacity]
+};
+
+// Arc filter, see parser.c. An arc is kept if (head POS, dependent POS, 
+// direction and distance) is often enough a gold arc in the sentences it
+// was built from. POS tags not seen there get the last index, 
+// and arcs with them are always kept
+#define DIR_DIST_NUM 16
+
+struct ArcFilter
+{
+    unordered_map<unsigned int, int> pos_index;     // POS ID -> dense index
+    int pos_num;
+    vector<unsigned char> allowed;  // [head][dep][dir_dist], pos_num + 1 each
+    
+    ArcFilter() : pos_num(0) {}
+};
+
+// Buffers of batched arc scoring, see score_first_order_batch(). They 
+// only ever grow, so every ParserContext keeps its own
+#define BATCH_PREFETCH_DISTANCE 16
+
+struct ScoreBatch
+{
+    vector<unsigned long> hash_list;
+    vector<int> offset_list;        // Features of arc k start at [k]
+    vector<int> dep_list;           // Arcs of a row, see score_arcs()
+    vector<float> score_list;
+};
+
+// Everything a thread needs to decode a sentence: the chart, the edges of 
+// the last tree, and the token hashes of the last sentence scored. Give 
+// every thread its own, and any number of sentences could be decoded at 
+// the same time (weights and vocabulary are only read)
+struct ParserContext
+{
+    EisnerChart chart;
+    SiblingChart sibling_chart;
+    
+    vector<Edge> edge_list;             // Only ever grows, see edge_list_index
+    int edge_list_index;
+    vector<EdgeRecoveryNode> recovery_stack;
+    
+    vector<TokenFeatureHash> token_hash_list;
+    SentenceKey hashed_key;
+    
+    // Head and dependent template sums of every token, 
+    // [token * DIR_DIST_NUM + dir_dist], see get_factorized_feature_score()
+    vector<float> head_score_list;
+    vector<float> dep_score_list;
+    vector<float> in_between_score_list;    // [head * n + dep], head < dep
+    SentenceKey in_between_key;
+    SentenceKey factorized_key;
+    
+    // If not NULL, arcs of sentences with at least parallel_score_length
+    // tokens are scored on this pool, see score_arcs(). The pool must not
+    // be the one this context is used from
+    ThreadPool *score_pool;
+    int parallel_score_length;
+    
+    ScoreBatch score_batch;
+    vector<ScoreBatch> worker_score_batch;  // One per score_pool worker
+    
+    // If not NULL, weights in it are added to weight_vector when scoring
+    // arcs, e.g. the local updates of a perceptron worker
+    WeightTable *delta_table;
+    
+    // If not NULL, arcs it rules out are not scored and get -inf
+    const ArcFilter *arc_filter;
+    vector<int> filter_pos_list;    // Dense POS index of every token
+    
+    ParserContext();
+    ~ParserContext();
+    
+    ParserContext(const ParserContext &) = delete;
+    ParserContext &operator=(const ParserContext &) = delete;
+};
+
+// One way of scoring arcs, set as a unit through arc_scorer:
+// - prepare, if not NULL, is called by score_arcs() on every sentence
+//   before any arc of it is scored, e.g. to fill per-sentence tables
+// - arc_weight scores one arc
+// - arc_weight_batch, if not NULL, scores arcs (head_index, dep_list[k])
+//   into score_list[k], the same as arc_weight would up to float rounding
+struct ArcScorer
+{
+    void (*prepare)(ParserContext *pc, Sentence *sent);
+    float (*arc_weight)(ParserContext *pc, Sentence *sent, int head_index,
+                        int dep_index);
+    void (*arc_weight_batch)(ParserContext *pc, Sentence *sent,
+                             int head_index, const int *dep_list,
+                             int arc_num, float *score_list,
+                             ScoreBatch *batch);
+};
+
 struct Feature
 {
     string *word ;  
@@ -135,16 +611,278 @@ struct Feature
 
 ///////////////////// Function Dealaration
 
+// Load sections [start, end] under root_path using worker_num threads
+// If cache_path is not empty, sentences are mapped from the binary cache
+// when it is up to date, and the cache is (re)built otherwise
+void load(int start, int end, string root_path, int worker_num = 1,
+          string cache_path = string(""));
+// Streaming alternative to load(), see data_pool.c
+void load_stream(int start, int end, string root_path, int max_sentence_num);
+void finish_stream();
+Sentence *get_next_sentence(Context *ctx);
+
+// Wall clock time in seconds, used for throughput accounting
+double get_wall_time();
+
+extern Vocabulary vocabulary;
+
+unsigned int intern_token(Vocabulary *vocab, const char *str, int len);
+void merge_vocabulary(Vocabulary *vocab, Vocabulary *local, 
+                      vector<unsigned int> *id_map);
+void clear_vocabulary(Vocabulary *vocab);
+
+inline VocabularyEntry *get_vocabulary_entry(const Vocabulary *vocab, 
+                                             unsigned int id)
+{
+    unsigned int biased_id = id + (1U << VOCAB_FIRST_CHUNK_BITS);
+    int top_bit = 31 - __builtin_clz(biased_id);
+    
+    return &vocab->chunk_list[top_bit - VOCAB_FIRST_CHUNK_BITS]
+                             [biased_id - (1U << top_bit)];
+}
+
+inline const unsigned char *get_token_str(unsigned int id)
+{
+    return (const unsigned char *)
+        get_vocabulary_entry(&vocabulary, id)->token.c_str();
+}
+
+inline const TokenHash *get_token_hash(unsigned int id)
+{
+    return &get_vocabulary_entry(&vocabulary, id)->token_hash;
+}
+
+// Same as feeding characters of t to hash_feature() after h
+inline unsigned long hash_concat(unsigned long h, const TokenHash *t)
+{
+    return h * t->power + t->hash;
+}
+
 // Used by parser to register callback
-float get_first_order_feature_score(Sentence *sent, int head_index, int dep_index);
+float get_first_order_feature_score(ParserContext *pc, Sentence *sent, 
+                                    int head_index, int dep_index);
+void precompute_sentence_hash(ParserContext *pc, Sentence *sent);
+int get_dir_and_dist(int head_index, int dep_index);
+float get_factorized_feature_score(ParserContext *pc, Sentence *sent, 
+                                   int head_index, int dep_index);
+int precompute_factorized_score(ParserContext *pc, Sentence *sent);
+int precompute_in_between_score(ParserContext *pc, Sentence *sent);
+int test_in_between_score(int max_sentence_num);
+void score_first_order_batch(ParserContext *pc, Sentence *sent, 
+                             int head_index, const int *dep_list, int arc_num,
+                             float *score_list, ScoreBatch *batch);
+int test_batch_score(int max_sentence_num);
+void add_random_weight(Sentence **sentence_list, int sentence_num);
+int test();
+int test_factorized_score(int max_sentence_num);
+float get_sibling_feature_score(ParserContext *pc, Sentence *sent, 
+                                int head_index, int sib_index, int dep_index);
+int extract_first_order_feature(ParserContext *pc, Sentence *sent, 
+                                int head_index, int dep_index, 
+                                unsigned long *hash_list, 
+                                unsigned short *type_list, int capacity);
+int extract_sibling_feature(ParserContext *pc, Sentence *sent, 
+                            int head_index, int sib_index, int dep_index, 
+                            unsigned long *hash_list, 
+                            unsigned short *type_list, int capacity);
+int test_feature_hash(int max_sentence_num);
+extern const ArcScorer first_order_scorer;
+extern const ArcScorer factorized_scorer;
 
-extern unordered_map<unsigned long, float> weight_vector;
+extern WeightTable weight_vector;
 
-inline float get_weight(unsigned long h)
+void init_weight_table(WeightTable *table, unsigned long capacity);
+void clear_weight_table(WeightTable *table);
+float *find_or_insert_weight(WeightTable *table, unsigned long h);
+void reserve_weight_table(WeightTable *table, unsigned long num);
+void add_weight(WeightTable *table, unsigned long h, float delta, 
+                unsigned int type);
+void add_feature_vector(WeightTable *table, const unsigned long *hash_list,
+                        const unsigned short *type_list, int num, float delta);
+float dot_feature_vector(const WeightTable *table, 
+                         const unsigned long *hash_list, int num);
+void merge_weight_table(WeightTable *table, const WeightTable *delta, 
+                        float mix);
+void enable_weight_average(WeightTable *table);
+void finalize_weight_average(WeightTable *table);
+void set_weight_average(WeightTable *table, bool use_average);
+int test_weight_average(unsigned long feature_num, int step_num, 
+                        int update_num);
+void save_model(const WeightTable *table, string model_path);
+bool map_model(WeightTable *table, string model_path);
+int test_model_file(string model_path);
+
+extern QuantizedModel quantized_model;
+float get_quantized_feature_score(ParserContext *pc, Sentence *sent, 
+                                  int head_index, int dep_index);
+extern const ArcScorer quantized_scorer;
+float get_quantized_sibling_score(ParserContext *pc, Sentence *sent, 
+                                  int head_index, int sib_index, 
+                                  int dep_index);
+void quantize_model(QuantizedModel *model, const WeightTable *table, 
+                    int format);
+int report_quantized_uas(int skip_sentence_num, int sentence_num, 
+                         int worker_num);
+int test_weight_table(unsigned long feature_num, unsigned long lookup_num);
+
+extern ArcScorer arc_scorer;
+void score_arcs(ParserContext *pc, Sentence *sent);
+float eisner_decode_scored(ParserContext *pc, Sentence *sent);
+float eisner_decode(ParserContext *pc, Sentence *sent);
+extern float (*sibling_weight)(ParserContext *pc, Sentence *sent, 
+                               int head_index, int sib_index, int dep_index);
+void score_sibling_parts(ParserContext *pc, Sentence *sent);
+float sibling_decode_scored(ParserContext *pc, Sentence *sent);
+float sibling_decode(ParserContext *pc, Sentence *sent);
+extern float (*tree_decoder)(ParserContext *pc, Sentence *sent);
+void decode_batch(ThreadPool *pool, ParserContext *context_list,
+                  Sentence **sentence_list, int sentence_num, 
+                  vector<Edge> *result_list, float *score_list);
+float evaluate_uas(ThreadPool *pool, Sentence **sentence_list, 
+                   int sentence_num, const ArcFilter *arc_filter = NULL);
+void build_arc_filter(ArcFilter *filter, Sentence **sentence_list, 
+                      int sentence_num, float min_gold_ratio);
+int test_eisner();
+void profile_decode(int max_sentence_num);
+int test_decode_batch(int max_sentence_num, int worker_num);
+int test_parallel_score(int worker_num);
+int test_scorer_parity(const ArcScorer *scorer, const char *name, 
+                       int skip_sentence_num, int sentence_num, 
+                       int worker_num);
+int test_sibling_decode(int max_sentence_num);
+float test_arc_filter(int train_sentence_num, int test_sentence_num, 
+                      float min_gold_ratio, int worker_num);
+
+void init_count_sketch(CountSketch *sketch, unsigned long byte_size, 
+                       int depth);
+void add_count_sketch(CountSketch *sketch, unsigned long h);
+unsigned int query_count_sketch(const CountSketch *sketch, unsigned long h);
+
+float train_perceptron(int epoch_num, int worker_num, int max_sentence_num,
+                       bool average = false, int feature_cutoff = 0, 
+                       unsigned long sketch_size = SKETCH_DEFAULT_SIZE,
+                       string model_path = "", bool second_order = false);
+
+// Span combination kernels, see eisner_kernel.c
+#define EISNER_KERNEL_SCALAR 0
+#define EISNER_KERNEL_SSE 1
+#define EISNER_KERNEL_AVX2 2
+#define EISNER_KERNEL_NUM 3
+
+typedef int (*ArgmaxSumKernel)(const float *a, const float *b, int begin, 
+                               int end, float c, float *max_score_p);
+extern ArgmaxSumKernel argmax_sum;
+
+bool set_eisner_kernel(int kernel);
+const char *get_eisner_kernel_name(int kernel);
+
+// Fibonacci hashing: the slot is taken from the high bits of the product,
+// which depend on all bits of the feature hash
+inline unsigned long get_weight_slot(const WeightTable *table, unsigned long h)
+{
+    return (unsigned long)(((uint64_t)h * 0x9E3779B97F4A7C15ULL) >> table->shift);
+}
+
+inline const WeightEntry *find_weight(const WeightTable *table, unsigned long h)
+{
+    if(h == WEIGHT_EMPTY_KEY) return NULL;
+    
+    unsigned long slot = get_weight_slot(table, h);
+    while(1)
+    {
+        const WeightEntry *entry = &table->entry_list[slot];
+        
+        if(entry->key == h) return entry;
+        if(entry->key == WEIGHT_EMPTY_KEY) return NULL;
+        
+        slot = (slot + 1) & table->mask;
+    }
+}
+
+// Bring the slot of h into cache ahead of get_table_weight(table, h)
+inline void prefetch_table_weight(const WeightTable *table, unsigned long h)
+{
+    __builtin_prefetch(&table->entry_list[get_weight_slot(table, h)]);
+}
+
+inline void prefetch_weight(unsigned long h)
+{
+    prefetch_table_weight(&weight_vector, h);
+}
+
+inline float get_table_weight(const WeightTable *table, unsigned long h)
 {
 	// To save space, just falsefully return 0.0. Do not add new entry here
-    if(weight_vector.count(h) == 0) return 0.0;
-    else return weight_vector.at(h);
+    if(h == WEIGHT_EMPTY_KEY) 
+    {
+        if(table->use_average) return table->sum_list[table->capacity];
+        return table->empty_key_weight;
+    }
+    
+    const WeightEntry *entry = find_weight(table, h);
+    if(entry == NULL) return 0.0;
+    if(table->use_average) return table->sum_list[entry - table->entry_list];
+    return entry->weight;
+}
+
+inline float get_weight(unsigned long h)
+{
+    return get_table_weight(&weight_vector, h);
+}
+
+inline float half_to_float(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t bits;
+    
+    // quantize_model() flushes subnormals to zero, and never overflows
+    if(exponent == 0) bits = sign;
+    else bits = sign | ((exponent - 15 + 127) << 23) | ((uint32_t)(half & 0x3FF) << 13);
+    
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    
+    return f;
+}
+
+// The slot is the top bits of the mixed hash, as in get_weight_slot(),
+// and the fingerprint the 16 bits right below them
+inline uint16_t get_quantized_fingerprint(uint64_t mixed, int shift)
+{
+    uint16_t fingerprint = (uint16_t)(mixed >> (shift - 16));
+    
+    return fingerprint == 0 ? 1 : fingerprint;
+}
+
+// type is the type value hashed into h. A key that is not in the model
+// but has the fingerprint of one in its probe sequence gets that weight;
+// with 16-bit fingerprints and short probe sequences this is rare
+inline float get_quantized_weight(const QuantizedModel *model, 
+                                  unsigned long h, unsigned long type)
+{
+    if(h == WEIGHT_EMPTY_KEY) return model->empty_key_weight;
+    
+    uint64_t mixed = (uint64_t)h * 0x9E3779B97F4A7C15ULL;
+    unsigned long slot = (unsigned long)(mixed >> model->shift);
+    uint16_t fingerprint = get_quantized_fingerprint(mixed, model->shift);
+    
+    while(1)
+    {
+        const QuantizedEntry *entry = &model->entry_list[slot];
+        
+        if(entry->fingerprint == fingerprint)
+        {
+            float value = model->format == QUANT_INT8 ? 
+                          (float)(int8_t)(entry->value & 0xFF) : 
+                          half_to_float(entry->value);
+            
+            return value * model->scale_list[type];
+        }
+        if(entry->fingerprint == 0) return 0.0;
+        
+        slot = (slot + 1) & model->mask;
+    }
 }
 
 inline unsigned long pack_type_dir_dist(unsigned long type, unsigned long dir_dist)
@@ -157,6 +895,6 @@ inline unsigned long pack_type_dir_dist(unsigned long type, unsigned long dir_di
 	h = hash_feature(type, num, feature_buffer + offset); \
     score += get_weight(h); \
     h = hash_feature(pack_type_dir_dist(type, dir_dist), num, feature_buffer + offset); \
-    score += h; }
+    score += get_weight(h); }
 
 #endif
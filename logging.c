@@ -28,6 +28,16 @@ static void logging_time()
     return;   
 }
 
+// clock() counts CPU time only, which hides the time we spend waiting for
+// the disk. Use this one when measuring I/O bound procedures
+double get_wall_time()
+{
+    using namespace std::chrono;
+    
+    return duration_cast<duration<double> >(
+        steady_clock::now().time_since_epoch()).count();
+}
+
 void logging_info()
 {
     
@@ -1,177 +1,164 @@
-
 #include "glm_parser.h"
 
-static int max_matrix_size = INIT_SENTENCE_LEN;
-float (*arc_weight)(Sentence *sent, int head_index, int dep_index) = get_first_order_feature_score;
-
-// Eisner Matrix
-static PP_EisnerNode ***e;
-
-/*
-    def init_eisner_matrix(self):
-        self.e = <PP_EisnerNode***>malloc(self.n*sizeof(PP_EisnerNode**))
-        cdef int i, j, k, l
-        for i in range(self.n):
-            self.e[i] = <P_EisnerNode***>calloc(self.n,sizeof(P_EisnerNode**))
-            for j in range(self.n):
-                self.e[i][j] = <P_EisnerNode**>calloc(2,sizeof(P_EisnerNode*))
-                for k in range(2):
-                    self.e[i][j][k] = <P_EisnerNode*>calloc(2,sizeof(P_EisnerNode))
-                    for l in range(2):
-                        self.e[i][j][k][l] = <P_EisnerNode>calloc(1,sizeof(EisnerNode))
-        return
-
-*/
-
-// Must be called at least once to init a parsing matrix
-void init_eisner_matrix(int n)
+// Scorer used by score_arcs(). Assign first_order_scorer, 
+// factorized_scorer or quantized_scorer to it as a whole
+ArcScorer arc_scorer = first_order_scorer;
+
+// The whole chart and the arc score matrix are a single allocation, 
+// aligned to CHART_ALIGN bytes
+void init_eisner_matrix(EisnerChart *e, int n)
 {	
-	e = (PP_EisnerNode ***)malloc(sizeof(PP_EisnerNode **) * n);
-	for(int i = 0;i < n;i++)
-	{
-		e[i] = (P_EisnerNode ***)malloc(sizeof(P_EisnerNode **) * n);
-		for(int j = 0;j < n;j++)
-		{
-			e[i][j] = (P_EisnerNode **)malloc(sizeof(P_EisnerNode *) * 2);
-			for(int k = 0;k < 2;k++)
-			{
-				e[i][j][k] = (P_EisnerNode *)malloc(sizeof(P_EisnerNode) * 2);
-				for(int l = 0;l < 2;l++)
-				{
-					e[i][j][k][l] = (P_EisnerNode)malloc(sizeof(EisnerNode));
-				}
-			}
-		}
-	}
+	e->n = n;
+	e->stride = (n + CHART_ALIGN_FLOAT - 1) / CHART_ALIGN_FLOAT * CHART_ALIGN_FLOAT;
+	
+	size_t plane_size = (size_t)n * e->stride;
+	size_t score_size = sizeof(float) * plane_size * 4;
+	size_t mid_index_size = sizeof(int) * plane_size * 4;
+	size_t arc_score_size = sizeof(float) * plane_size;
+	
+	e->block = malloc(score_size + mid_index_size + arc_score_size + CHART_ALIGN);
+	if(e->block == NULL) ERROR("Allocate eisner matrix of size %d fails!", n);
+	
+	uintptr_t aligned = ((uintptr_t)e->block + CHART_ALIGN - 1) & 
+	                    ~(uintptr_t)(CHART_ALIGN - 1);
+	e->score = (float *)aligned;
+	e->mid_index = (int *)(aligned + score_size);
+	e->arc_score = (float *)(aligned + score_size + mid_index_size);
 	
 	return;
 }
 
-/*
-	def delete_eisner_matrix(self):
-        cdef int i, j, k
-        for i in range(self.n):
-            for j in range(self.n):
-                for k in range(2):
-                    for l in range(2):
-                        free(self.e[i][j][k][l])
-                    free(self.e[i][j][k])
-                free(self.e[i][j])
-            free(self.e[i])
-*/
-void free_eisner_matrix(int n)
+void free_eisner_matrix(EisnerChart *e)
 {
-	for(int i = 0;i < n;i++)
-	{
-		for(int j = 0;j < n;j++)
-		{
-			for(int k = 0;k < 2;k++)
-			{
-				for(int l = 0;l < 2;l++)
-				{
-					free(e[i][j][k][l]);
-				}
-				free(e[i][j][k]);
-			}
-			free(e[i][j]);
-		}
-		free(e[i]);
-	}
+	free(e->block);
+	
+	e->block = NULL;
+	e->score = NULL;
+	e->mid_index = NULL;
+	e->arc_score = NULL;
+	e->n = e->stride = 0;
 	
 	return;
 }
 
 // For efficiency consideration, we do not allocate and free memory everytime
 // We only keep the largest size eisner matrix in memory, and if the target sentence
-// is longer, we free the memory blocks and re-allocate
+// is longer, we free the memory block and re-allocate
 // It mush be called on before every parsing procedure begins
-void resize_eisner_matrix(Sentence *sent)
+void resize_eisner_matrix(EisnerChart *e, Sentence *sent)
 {
-	int current_len = sent->word_list.size();
-	if(current_len > max_matrix_size)
+	int current_len = sent->length;
+	if(current_len > e->n)
 	{
-		free_eisner_matrix(max_matrix_size);
-		init_eisner_matrix(current_len);
-		max_matrix_size = current_len;
+		free_eisner_matrix(e);
+		init_eisner_matrix(e, current_len > INIT_SENTENCE_LEN ? 
+		                      current_len : INIT_SENTENCE_LEN);
 	}
 	
 	return;
 }
 
+// The chart is allocated on first use
+ParserContext::ParserContext()
+{
+	edge_list_index = 0;
+	score_pool = NULL;
+	parallel_score_length = PARALLEL_SCORE_MIN_LENGTH;
+	delta_table = NULL;
+	arc_filter = NULL;
+}
+
+ParserContext::~ParserContext()
+{
+	free_eisner_matrix(&chart);
+}
+
+// Row s of the plane (orientation, shape). Since the plane is mirrored,
+// row s holds e[s][q] for q >= s, and e[q][s] for q <= s
+inline float *chart_row(EisnerChart *e, int orientation, int shape, int s)
+{
+	return e->score + ((size_t)(orientation * 2 + shape) * e->n + s) * e->stride;
+}
+
+inline int *chart_mid_index(EisnerChart *e, int s, int t, int orientation, 
+                            int shape)
+{
+	return e->mid_index + 
+	       ((size_t)(orientation * 2 + shape) * e->n + s) * e->stride + t;
+}
+
+inline float get_chart_score(EisnerChart *e, int s, int t, int orientation, 
+                             int shape)
+{
+	return chart_row(e, orientation, shape, s)[t];
+}
+
+inline float get_arc_score(EisnerChart *e, int head, int modifier)
+{
+	return e->arc_score[(size_t)head * e->stride + modifier];
+}
+
+inline void set_chart(EisnerChart *e, int s, int t, int orientation, int shape, 
+                      float score, int mid_index)
+{
+	chart_row(e, orientation, shape, s)[t] = score;
+	chart_row(e, orientation, shape, t)[s] = score;
+	*chart_mid_index(e, s, t, orientation, shape) = mid_index;
+	
+	return;
+}
+
 // max_index is used to return a value
-float combine_triangle(Sentence *sent, int head, int modifier, int *max_index_p)
+// The q loops are done by argmax_sum(), see eisner_kernel.c
+float combine_triangle(EisnerChart *e, int head, int modifier, int *max_index_p)
 {
 	//assert(head != modifier)
-	int s, t, q;
+	int s, t;
 	
 	if(head < modifier) s = head, t = modifier;
 	else t = head, s = modifier;
 	
-	float edge_score = arc_weight(sent, head, modifier);
-	int max_index = s;
+	float edge_score = get_arc_score(e, head, modifier);
+	// e[s][q][1][0] + e[q + 1][t][0][0] for q in [s, t)
+	const float *left = chart_row(e, 1, 0, s);
+	const float *right = chart_row(e, 0, 0, t) + 1;
 	
-	float max_score = e[s][s][1][0]->score + e[q + 1][t] [0][0]->score + edge_score;
-	float current_score;
+	float max_score;
+	*max_index_p = argmax_sum(left, right, s, t, edge_score, &max_score);
 	
-	for(q = s + 1;q < t;q++)
-	{
-		current_score = e[s][q][1][0]->score + e[q + 1][t][0][0]->score + edge_score;
-		if(max_score < current_score)
-		{
-			max_score = current_score;
-			max_index = q;
-		}
-	}
-	
-	*max_index_p = max_index;
 	return max_score;
 }
 
-float combine_left(int s, int t, int *max_index_p)
+float combine_left(EisnerChart *e, int s, int t, int *max_index_p)
 {       
-    int max_index = s;
-    float max_score = e[s][s][0][0]->score + e[s][t][0][1]->score;
-
-    float current_score;
-    for(int q = s + 1;q < t;q++)
-	{
-    	current_score = e[s][q][0][0]->score + e[q][t][0][1]->score;
-        if(max_score < current_score)
-        {
-            max_score = current_score;
-            max_index = q;
-        }
-	}
+	// e[s][q][0][0] + e[q][t][0][1] for q in [s, t)
+	const float *left = chart_row(e, 0, 0, s);
+	const float *right = chart_row(e, 0, 1, t);
+	
+	float max_score;
+	*max_index_p = argmax_sum(left, right, s, t, 0.0, &max_score);
 	
-	*max_index_p = max_index;
     return max_score; 
 }
 
-float combine_right(int s, int t, int *max_index_p)
+float combine_right(EisnerChart *e, int s, int t, int *max_index_p)
 {
-    int max_index = s + 1;
-    float max_score = e[s][s + 1][1][1]->score + e[s + 1][t][1][0]->score;
-    
-    float current_score;
-    for(int q = s + 2;q <= t;q++)
-    {
-        current_score = e[s][q][1][1]->score + e[q][t][1][0]->score;
-        if(max_score < current_score)
-        {
-            max_score = current_score;
-            max_index = q;
-        }
-	}
-	
-    *max_index_p = max_index;
+	// e[s][q][1][1] + e[q][t][1][0] for q in [s + 1, t]
+	const float *left = chart_row(e, 1, 1, s);
+	const float *right = chart_row(e, 1, 0, t);
+	
+	float max_score;
+	*max_index_p = argmax_sum(left, right, s + 1, t + 1, 0.0, &max_score);
+	
     return max_score;
 }
 
-inline void split_right_triangle(EdgeRecoveryNode *node, 
+inline void split_right_triangle(ParserContext *pc,
+                                 EdgeRecoveryNode *node, 
 								 EdgeRecoveryNode *left, 
 								 EdgeRecoveryNode *right)
 {
-    int q = e[node->s][node->t][1][0]->mid_index;
+    int q = *chart_mid_index(&pc->chart, node->s, node->t, 1, 0);
         
     *left = EdgeRecoveryNode(node->s, q, 1, 1);
     *right = EdgeRecoveryNode(q, node->t, 1, 0);
@@ -179,11 +166,12 @@ inline void split_right_triangle(EdgeRecoveryNode *node,
     return;
 }
 
-void split_left_triangle(EdgeRecoveryNode *node,
+void split_left_triangle(ParserContext *pc,
+                         EdgeRecoveryNode *node,
 						 EdgeRecoveryNode *left,
 						 EdgeRecoveryNode *right)
 {
-    int q = e[node->s][node->t][0][0]->mid_index;
+    int q = *chart_mid_index(&pc->chart, node->s, node->t, 0, 0);
         
     *left = EdgeRecoveryNode(node->s, q, 0, 0);
     *right = EdgeRecoveryNode(q, node->t, 0, 1);
@@ -191,33 +179,1259 @@ void split_left_triangle(EdgeRecoveryNode *node,
 	return;
 }
 
-static int edge_list_index = 0;
-Edge edge_list[MAX_EDGE_LIST_SIZE];
-
-void split_right_trapezoid(EdgeRecoveryNode *node,
+void split_right_trapezoid(ParserContext *pc,
+                           EdgeRecoveryNode *node,
 						   EdgeRecoveryNode *left,
 						   EdgeRecoveryNode *right)
 {
     Edge ee(node->s, node->t);
-    edge_list[edge_list_index++] = ee;
+    pc->edge_list[pc->edge_list_index++] = ee;
 
-    int q = e[node->s][node->t][1][1]->mid_index;
+    int q = *chart_mid_index(&pc->chart, node->s, node->t, 1, 1);
     *left = EdgeRecoveryNode(node->s, q, 1, 0);
     *right = EdgeRecoveryNode(q + 1, node->t, 0, 0);
         
     return;
 }
 
-void split_left_trapezoid(EdgeRecoveryNode *node,
-						   EdgeRecoveryNode *left,
-						   EdgeRecoveryNode *right)
+void split_left_trapezoid(ParserContext *pc,
+                          EdgeRecoveryNode *node,
+						  EdgeRecoveryNode *left,
+						  EdgeRecoveryNode *right)
 {
     Edge ee(node->t, node->s);
-    edge_list[edge_list_index++] = ee;
+    pc->edge_list[pc->edge_list_index++] = ee;
 
-    int q = e[node->s][node->t][0][1]->mid_index;
+    int q = *chart_mid_index(&pc->chart, node->s, node->t, 0, 1);
     *left = EdgeRecoveryNode(node->s, q, 1, 0);
     *right = EdgeRecoveryNode(q + 1, node->t, 0, 0);
         
     return;
 }
+
+// Walk back from the complete span [0, n - 1] headed by ROOT, and 
+// collect edges into pc->edge_list
+static void recover_edge_list(ParserContext *pc, int n)
+{
+	vector<EdgeRecoveryNode> &stack = pc->recovery_stack;
+	
+	if((int)pc->edge_list.size() < n) pc->edge_list.resize(n);
+	pc->edge_list_index = 0;
+	stack.clear();
+	stack.push_back(EdgeRecoveryNode(0, n - 1, 1, 0));
+	
+	while(!stack.empty())
+	{
+		EdgeRecoveryNode node = stack.back();
+		stack.pop_back();
+		if(node.s == node.t) continue;
+		
+		EdgeRecoveryNode left, right;
+		if(node.shape == 0)
+		{
+			if(node.orientation == 1) 
+				split_right_triangle(pc, &node, &left, &right);
+			else split_left_triangle(pc, &node, &left, &right);
+		}
+		else
+		{
+			if(node.orientation == 1) 
+				split_right_trapezoid(pc, &node, &left, &right);
+			else split_left_trapezoid(pc, &node, &left, &right);
+		}
+		
+		stack.push_back(left);
+		stack.push_back(right);
+	}
+	
+	return;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Arc pruning
+//
+// Most (head, modifier) pairs never make it into a good tree, e.g. a 
+// determiner heading a verb ten words away. An ArcFilter remembers which
+// (head POS, dependent POS, dir_dist) triples are gold often enough, and
+// score_arcs() gives every other arc -inf without scoring it
+// Arcs between neighbours are never pruned, so the right branching chain
+// is always there and the decoder still finds a tree
+
+// Index pos_num is for POS tags the filter has not seen
+static int get_filter_pos(const ArcFilter *filter, unsigned int pos)
+{
+	unordered_map<unsigned int, int>::const_iterator it = 
+		filter->pos_index.find(pos);
+	
+	return it == filter->pos_index.end() ? filter->pos_num : it->second;
+}
+
+inline size_t get_filter_cell(const ArcFilter *filter, int head_pos, 
+                              int dep_pos, int dir_dist)
+{
+	return ((size_t)head_pos * (filter->pos_num + 1) + dep_pos) * 
+	       DIR_DIST_NUM + dir_dist;
+}
+
+inline bool is_arc_allowed(const ArcFilter *filter, const int *pos_list, 
+                           int head, int modifier)
+{
+	int head_pos = pos_list[head], dep_pos = pos_list[modifier];
+	
+	if(head - modifier == 1 || modifier - head == 1 || 
+	   head_pos == filter->pos_num || dep_pos == filter->pos_num) return true;
+	
+	return filter->allowed[get_filter_cell(filter, head_pos, dep_pos, 
+	                                       get_dir_and_dist(head, modifier))];
+}
+
+// Count arcs of sentence_list by (head POS, dependent POS, dir_dist), 
+// both all candidate arcs and gold ones, and keep the triples that are 
+// gold at least min_gold_ratio of the time
+void build_arc_filter(ArcFilter *filter, Sentence **sentence_list, 
+                      int sentence_num, float min_gold_ratio)
+{
+	filter->pos_index.clear();
+	for(int i = 0;i < sentence_num;i++)
+	{
+		Sentence *sent = sentence_list[i];
+		for(int j = 0;j < sent->length;j++)
+		{
+			if(filter->pos_index.find(sent->pos_list[j]) == 
+			   filter->pos_index.end())
+			{
+				int index = filter->pos_index.size();
+				filter->pos_index[sent->pos_list[j]] = index;
+			}
+		}
+	}
+	filter->pos_num = filter->pos_index.size();
+	
+	size_t cell_num = (size_t)(filter->pos_num + 1) * (filter->pos_num + 1) * 
+	                  DIR_DIST_NUM;
+	vector<long> arc_count_list(cell_num, 0), gold_count_list(cell_num, 0);
+	vector<int> pos_list;
+	for(int i = 0;i < sentence_num;i++)
+	{
+		Sentence *sent = sentence_list[i];
+		
+		pos_list.resize(sent->length);
+		for(int j = 0;j < sent->length;j++) 
+			pos_list[j] = get_filter_pos(filter, sent->pos_list[j]);
+		
+		for(int head = 0;head < sent->length;head++)
+		{
+			for(int dep = 1;dep < sent->length;dep++)
+			{
+				if(head == dep) continue;
+				arc_count_list[get_filter_cell(filter, pos_list[head], 
+				    pos_list[dep], get_dir_and_dist(head, dep))]++;
+			}
+		}
+		for(int j = 0;j < sent->gold_edge_num;j++)
+		{
+			int head = sent->gold_edge_list[j].head_index;
+			int dep = sent->gold_edge_list[j].dep_index;
+			
+			gold_count_list[get_filter_cell(filter, pos_list[head], 
+			    pos_list[dep], get_dir_and_dist(head, dep))]++;
+		}
+	}
+	
+	filter->allowed.assign(cell_num, 0);
+	for(size_t i = 0;i < cell_num;i++) 
+	{
+		filter->allowed[i] = gold_count_list[i] > 0 && 
+		    gold_count_list[i] >= min_gold_ratio * arc_count_list[i];
+	}
+	
+	return;
+}
+
+// Rows [head_begin, head_end) of the arc score matrix. If the scorer has
+// arc_weight_batch, the arcs of a head are scored in one call, using the 
+// buffers of batch
+static void score_arc_rows(ParserContext *pc, Sentence *sent, 
+                           int head_begin, int head_end, ScoreBatch *batch)
+{
+	EisnerChart *e = &pc->chart;
+	const ArcFilter *filter = pc->arc_filter;
+	const int *pos_list = filter != NULL ? &pc->filter_pos_list[0] : NULL;
+	const ArcScorer &scorer = arc_scorer;
+	int n = sent->length;
+	vector<int> &dep_list = batch->dep_list;
+	vector<float> &score_list = batch->score_list;
+	
+	for(int head = head_begin;head < head_end;head++)
+	{
+		float *row = e->arc_score + (size_t)head * e->stride;
+		
+		row[0] = 0.0;
+		dep_list.clear();
+		for(int modifier = 1;modifier < n;modifier++)
+		{
+			if(head == modifier) row[modifier] = 0.0;
+			else if(filter != NULL && 
+			        !is_arc_allowed(filter, pos_list, head, modifier)) 
+				row[modifier] = -INFINITY;
+			else if(scorer.arc_weight_batch != NULL) dep_list.push_back(modifier);
+			else row[modifier] = scorer.arc_weight(pc, sent, head, modifier);
+		}
+		
+		if(dep_list.empty()) continue;
+		
+		if(score_list.size() < dep_list.size()) 
+			score_list.resize(dep_list.size());
+		scorer.arc_weight_batch(pc, sent, head, &dep_list[0], dep_list.size(),
+		                        &score_list[0], batch);
+		for(size_t k = 0;k < dep_list.size();k++) 
+			row[dep_list[k]] = score_list[k];
+	}
+	
+	return;
+}
+
+// Fill the arc score matrix with arc_scorer, one arc or one head at a 
+// time. This is the only place the decoder scores arcs
+// Arcs into ROOT and self loops are never used and are not scored, nor 
+// are arcs pc->arc_filter rules out
+// For long sentences, if pc->score_pool is set, blocks of 
+// PARALLEL_SCORE_HEAD_NUM heads are scored by the workers of the pool.
+// Token hashes and whatever arc_scorer.prepare() fills are computed before
+// that, so workers only read pc, apart from a ScoreBatch of their own
+void score_arcs(ParserContext *pc, Sentence *sent)
+{
+	int n = sent->length;
+	
+	resize_eisner_matrix(&pc->chart, sent);
+	if(pc->arc_filter != NULL)
+	{
+		pc->filter_pos_list.resize(n);
+		for(int i = 0;i < n;i++) 
+			pc->filter_pos_list[i] = get_filter_pos(pc->arc_filter, 
+			                                        sent->pos_list[i]);
+	}
+	
+	if(arc_scorer.prepare != NULL) arc_scorer.prepare(pc, sent);
+	
+	if(pc->score_pool == NULL || pc->score_pool->thread_num == 1 || 
+	   n < pc->parallel_score_length)
+	{
+		score_arc_rows(pc, sent, 0, n, &pc->score_batch);
+		
+		return;
+	}
+	
+	if(SentenceKey(sent) != pc->hashed_key) precompute_sentence_hash(pc, sent);
+	
+	if((int)pc->worker_score_batch.size() < pc->score_pool->thread_num)
+		pc->worker_score_batch.resize(pc->score_pool->thread_num);
+	
+	int block_num = (n + PARALLEL_SCORE_HEAD_NUM - 1) / PARALLEL_SCORE_HEAD_NUM;
+	pc->score_pool->run(block_num, [&](int block_index, int worker_index) {
+		int head_begin = block_index * PARALLEL_SCORE_HEAD_NUM;
+		int head_end = min(head_begin + PARALLEL_SCORE_HEAD_NUM, n);
+		
+		score_arc_rows(pc, sent, head_begin, head_end, 
+		               &pc->worker_score_batch[worker_index]);
+	});
+	
+	return;
+}
+
+// First order Eisner decoding over the scores from the last score_arcs() 
+// call on the sentence. The best tree is left in pc->edge_list, with 
+// pc->edge_list_index edges, and its score is returned
+float eisner_decode_scored(ParserContext *pc, Sentence *sent)
+{
+	EisnerChart *e = &pc->chart;
+	int n = sent->length;
+	int q;
+	
+	for(int s = 0;s < n;s++)
+	{
+		for(int orientation = 0;orientation < 2;orientation++)
+			for(int shape = 0;shape < 2;shape++)
+				set_chart(e, s, s, orientation, shape, 0.0, s);
+	}
+	
+	for(int m = 1;m < n;m++)
+	{
+		for(int s = 0;s + m < n;s++)
+		{
+			int t = s + m;
+			float score;
+			
+			score = combine_triangle(e, t, s, &q);
+			set_chart(e, s, t, 0, 1, score, q);
+			score = combine_triangle(e, s, t, &q);
+			set_chart(e, s, t, 1, 1, score, q);
+			// These two use the trapezoids above
+			score = combine_left(e, s, t, &q);
+			set_chart(e, s, t, 0, 0, score, q);
+			score = combine_right(e, s, t, &q);
+			set_chart(e, s, t, 1, 0, score, q);
+		}
+	}
+	
+	recover_edge_list(pc, n);
+	
+	return get_chart_score(e, 0, n - 1, 1, 0);
+}
+
+float eisner_decode(ParserContext *pc, Sentence *sent)
+{
+	score_arcs(pc, sent);
+	
+	return eisner_decode_scored(pc, sent);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Second order sibling decoding
+//
+// Eisner's algorithm with sibling items (McDonald and Pereira, 2006). On 
+// top of complete (C) and incomplete (I) spans, S(s, t) joins the right
+// half of s to the left half of t, where s < t are modifiers of one head
+// next to each other. part(h, r, m) is the score of arc h -> m with r as 
+// the previous modifier of h on that side, or - for none. For s < t:
+//   S(s, t)     = max C(s, r, ->) + C(r + 1, t, <-)           s <= r < t
+//   I(s, t, ->) = max C(s + 1, t, <-) + part(s, -, t),
+//                     I(s, r, ->) + S(r, t) + part(s, r, t)   s < r < t
+//   I(s, t, <-) = max C(s, t - 1, ->) + part(t, -, s),
+//                     S(s, r) + I(r, t, <-) + part(t, r, s)   s < r < t
+//   C(s, t, ->) = max I(s, r, ->) + C(r, t, ->)               s < r <= t
+//   C(s, t, <-) = max C(s, r, <-) + I(r, t, <-)               s <= r < t
+// This is O(n^3) like first order Eisner, with five q loops per span 
+// instead of four. All parts are scored by score_sibling_parts() before
+// the chart is filled, so the loops only read arrays
+
+float (*sibling_weight)(ParserContext *pc, Sentence *sent, int head_index, 
+                        int sib_index, int dep_index) = 
+	get_sibling_feature_score;
+
+// Like resize_eisner_matrix(), only ever grows
+static void resize_sibling_chart(SiblingChart *e, int n)
+{
+	if(n <= e->n) return;
+	
+	size_t cell_num = (size_t)n * n;
+	for(int i = 0;i < 2;i++)
+	{
+		e->complete[i].resize(cell_num);
+		e->incomplete[i].resize(cell_num);
+		e->complete_mid[i].resize(cell_num);
+		e->incomplete_mid[i].resize(cell_num);
+	}
+	e->sibling.resize(cell_num);
+	e->sibling_mid.resize(cell_num);
+	e->part_offset.resize(cell_num);
+	e->n = n;
+	
+	return;
+}
+
+inline void set_sibling_item(vector<float> &table, vector<int> &mid, int n,
+                             int s, int t, float score, int r)
+{
+	table[(size_t)s * n + t] = score;
+	table[(size_t)t * n + s] = score;
+	mid[(size_t)s * n + t] = r;
+	
+	return;
+}
+
+// Continue from the best (*max_index_p, *max_score_p) over q in 
+// [begin, end) with a[q] + b[q] + c[q], first index on ties
+inline void argmax_sum3(const float *a, const float *b, const float *c, 
+                        int begin, int end, int *max_index_p, 
+                        float *max_score_p)
+{
+	float max_score = *max_score_p;
+	int max_index = *max_index_p;
+	
+	for(int q = begin;q < end;q++)
+	{
+		float current_score = a[q] + b[q] + c[q];
+		if(max_score < current_score)
+		{
+			max_score = current_score;
+			max_index = q;
+		}
+	}
+	
+	*max_score_p = max_score;
+	*max_index_p = max_index;
+	
+	return;
+}
+
+// Fill part_score with arc_score from the last score_arcs() call plus
+// sibling_weight(). Parts whose arc, or the arc to the sibling, has been
+// pruned get -inf and are not scored
+void score_sibling_parts(ParserContext *pc, Sentence *sent)
+{
+	SiblingChart *e = &pc->sibling_chart;
+	int n = sent->length;
+	
+	resize_sibling_chart(e, n);
+	
+	size_t part_num = 0;
+	for(int head = 0;head < n;head++)
+	{
+		for(int dep = 1;dep < n;dep++)
+		{
+			if(head == dep) continue;
+			e->part_offset[(size_t)head * e->n + dep] = part_num;
+			part_num += abs(head - dep);
+		}
+	}
+	e->part_score.resize(part_num);
+	
+	for(int head = 0;head < n;head++)
+	{
+		for(int dep = 1;dep < n;dep++)
+		{
+			if(head == dep) continue;
+			
+			float *part = &e->part_score[e->part_offset[(size_t)head * e->n + dep]];
+			float arc_score = get_arc_score(&pc->chart, head, dep);
+			int low = min(head, dep), high = max(head, dep);
+			
+			if(arc_score == -INFINITY)
+			{
+				fill(part, part + high - low, -INFINITY);
+				continue;
+			}
+			
+			part[0] = arc_score + sibling_weight(pc, sent, head, head, dep);
+			for(int sib = low + 1;sib < high;sib++)
+			{
+				if(get_arc_score(&pc->chart, head, sib) == -INFINITY)
+					part[sib - low] = -INFINITY;
+				else part[sib - low] = arc_score + 
+				                       sibling_weight(pc, sent, head, sib, dep);
+			}
+		}
+	}
+	
+	return;
+}
+
+// Walk back from C(0, n - 1, ->). Shape 0 is C, 1 is I and 2 is S
+static void recover_sibling_edge_list(ParserContext *pc, int n)
+{
+	SiblingChart *e = &pc->sibling_chart;
+	vector<EdgeRecoveryNode> &stack = pc->recovery_stack;
+	
+	if((int)pc->edge_list.size() < n) pc->edge_list.resize(n);
+	pc->edge_list_index = 0;
+	stack.clear();
+	stack.push_back(EdgeRecoveryNode(0, n - 1, SIBLING_CHART_RIGHT, 0));
+	
+	while(!stack.empty())
+	{
+		EdgeRecoveryNode node = stack.back();
+		stack.pop_back();
+		if(node.s == node.t) continue;
+		
+		int s = node.s, t = node.t;
+		size_t cell = (size_t)s * e->n + t;
+		
+		if(node.shape == 2)
+		{
+			int r = e->sibling_mid[cell];
+			stack.push_back(EdgeRecoveryNode(s, r, SIBLING_CHART_RIGHT, 0));
+			stack.push_back(EdgeRecoveryNode(r + 1, t, SIBLING_CHART_LEFT, 0));
+		}
+		else if(node.shape == 0)
+		{
+			int r = e->complete_mid[node.orientation][cell];
+			if(node.orientation == SIBLING_CHART_RIGHT)
+			{
+				stack.push_back(EdgeRecoveryNode(s, r, SIBLING_CHART_RIGHT, 1));
+				stack.push_back(EdgeRecoveryNode(r, t, SIBLING_CHART_RIGHT, 0));
+			}
+			else
+			{
+				stack.push_back(EdgeRecoveryNode(s, r, SIBLING_CHART_LEFT, 0));
+				stack.push_back(EdgeRecoveryNode(r, t, SIBLING_CHART_LEFT, 1));
+			}
+		}
+		else
+		{
+			int r = e->incomplete_mid[node.orientation][cell];
+			if(node.orientation == SIBLING_CHART_RIGHT)
+			{
+				pc->edge_list[pc->edge_list_index++] = Edge(s, t);
+				if(r == s) 
+					stack.push_back(EdgeRecoveryNode(s + 1, t, SIBLING_CHART_LEFT, 0));
+				else
+				{
+					stack.push_back(EdgeRecoveryNode(s, r, SIBLING_CHART_RIGHT, 1));
+					stack.push_back(EdgeRecoveryNode(r, t, 0, 2));
+				}
+			}
+			else
+			{
+				pc->edge_list[pc->edge_list_index++] = Edge(t, s);
+				if(r == t) 
+					stack.push_back(EdgeRecoveryNode(s, t - 1, SIBLING_CHART_RIGHT, 0));
+				else
+				{
+					stack.push_back(EdgeRecoveryNode(s, r, 0, 2));
+					stack.push_back(EdgeRecoveryNode(r, t, SIBLING_CHART_LEFT, 1));
+				}
+			}
+		}
+	}
+	
+	return;
+}
+
+// Second order decoding over the parts from the last score_sibling_parts()
+// call on the sentence. Like eisner_decode_scored(), the best tree is 
+// left in pc->edge_list and its score is returned
+float sibling_decode_scored(ParserContext *pc, Sentence *sent)
+{
+	SiblingChart *e = &pc->sibling_chart;
+	int n = sent->length;
+	int N = e->n;
+	
+	for(int s = 0;s < n;s++)
+	{
+		for(int orientation = 0;orientation < 2;orientation++)
+		{
+			set_sibling_item(e->complete[orientation], 
+			                 e->complete_mid[orientation], N, s, s, 0.0, s);
+			set_sibling_item(e->incomplete[orientation], 
+			                 e->incomplete_mid[orientation], N, s, s, 0.0, s);
+		}
+		set_sibling_item(e->sibling, e->sibling_mid, N, s, s, 0.0, s);
+	}
+	
+	const float *right_complete = &e->complete[SIBLING_CHART_RIGHT][0];
+	const float *left_complete = &e->complete[SIBLING_CHART_LEFT][0];
+	const float *right_incomplete = &e->incomplete[SIBLING_CHART_RIGHT][0];
+	const float *left_incomplete = &e->incomplete[SIBLING_CHART_LEFT][0];
+	const float *sibling = &e->sibling[0];
+	
+	for(int m = 1;m < n;m++)
+	{
+		for(int s = 0;s + m < n;s++)
+		{
+			int t = s + m;
+			size_t row_s = (size_t)s * N, row_t = (size_t)t * N;
+			float score;
+			int r;
+			
+			// S(s, t); C(r + 1, t, <-) is row t mirrored
+			r = argmax_sum(right_complete + row_s, left_complete + row_t + 1,
+			               s, t, 0.0, &score);
+			set_sibling_item(e->sibling, e->sibling_mid, N, s, t, score, r);
+			
+			// I(s, t, ->), with part(s, r, t) at [r - s]
+			const float *part = &e->part_score[e->part_offset[row_s + t]] - s;
+			r = s;
+			score = left_complete[(size_t)(s + 1) * N + t] + part[s];
+			argmax_sum3(right_incomplete + row_s, sibling + row_t, part, 
+			            s + 1, t, &r, &score);
+			set_sibling_item(e->incomplete[SIBLING_CHART_RIGHT], 
+			                 e->incomplete_mid[SIBLING_CHART_RIGHT], N, s, t,
+			                 score, r);
+			
+			// I(s, t, <-), with part(t, r, s) at [r - s]. ROOT is never a 
+			// modifier, so there are no parts (t, r, 0) and I(0, t, <-) is
+			// -inf
+			r = t;
+			if(s == 0) score = -INFINITY;
+			else
+			{
+				part = &e->part_score[e->part_offset[row_t + s]] - s;
+				score = right_complete[row_s + t - 1] + part[s];
+				argmax_sum3(sibling + row_s, left_incomplete + row_t, part, 
+				            s + 1, t, &r, &score);
+			}
+			set_sibling_item(e->incomplete[SIBLING_CHART_LEFT], 
+			                 e->incomplete_mid[SIBLING_CHART_LEFT], N, s, t,
+			                 score, r);
+			
+			// These two use the incomplete items above
+			r = argmax_sum(right_incomplete + row_s, right_complete + row_t,
+			               s + 1, t + 1, 0.0, &score);
+			set_sibling_item(e->complete[SIBLING_CHART_RIGHT], 
+			                 e->complete_mid[SIBLING_CHART_RIGHT], N, s, t,
+			                 score, r);
+			r = argmax_sum(left_complete + row_s, left_incomplete + row_t,
+			               s, t, 0.0, &score);
+			set_sibling_item(e->complete[SIBLING_CHART_LEFT], 
+			                 e->complete_mid[SIBLING_CHART_LEFT], N, s, t,
+			                 score, r);
+		}
+	}
+	
+	recover_sibling_edge_list(pc, n);
+	
+	return right_complete[n - 1];
+}
+
+float sibling_decode(ParserContext *pc, Sentence *sent)
+{
+	score_arcs(pc, sent);
+	score_sibling_parts(pc, sent);
+	
+	return sibling_decode_scored(pc, sent);
+}
+
+// Decoder used by decode_batch() and the trainer, eisner_decode() or 
+// sibling_decode()
+float (*tree_decoder)(ParserContext *pc, Sentence *sent) = eisner_decode;
+
+// Decode sentence_list[0, sentence_num) with tree_decoder on the workers 
+// of pool. Worker i uses context_list[i], so there must be 
+// pool->thread_num contexts. The edges of sentence i go to result_list[i]
+// and its score to score_list[i] (either could be NULL)
+// Sentences are handed out one at a time, longest first, so that the 
+// long ones are not left to the end while other workers sit idle
+void decode_batch(ThreadPool *pool, ParserContext *context_list,
+                  Sentence **sentence_list, int sentence_num, 
+                  vector<Edge> *result_list, float *score_list)
+{
+	vector<int> order(sentence_num);
+	for(int i = 0;i < sentence_num;i++) order[i] = i;
+	stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return sentence_list[a]->length > sentence_list[b]->length;
+	});
+	
+	pool->run(sentence_num, [&](int task_index, int worker_index) {
+		ParserContext *pc = &context_list[worker_index];
+		int i = order[task_index];
+		
+		float score = tree_decoder(pc, sentence_list[i]);
+		
+		if(score_list != NULL) score_list[i] = score;
+		if(result_list != NULL) 
+			result_list[i].assign(pc->edge_list.begin(), 
+			                      pc->edge_list.begin() + pc->edge_list_index);
+	});
+	
+	return;
+}
+
+// Fraction of heads in sentence_list that are the gold head in the trees
+// of result_list
+static float get_uas(Sentence **sentence_list, int sentence_num, 
+                     const vector<Edge> *result_list)
+{
+	long correct_num = 0, token_num = 0;
+	
+	for(int i = 0;i < sentence_num;i++)
+	{
+		Sentence *sent = sentence_list[i];
+		vector<int> head_list(sent->length, -1);
+		
+		for(size_t j = 0;j < result_list[i].size();j++)
+			head_list[result_list[i][j].dep_index] = result_list[i][j].head_index;
+		for(int j = 0;j < sent->gold_edge_num;j++)
+		{
+			if(head_list[sent->gold_edge_list[j].dep_index] == 
+			   sent->gold_edge_list[j].head_index) correct_num++;
+		}
+		token_num += sent->gold_edge_num;
+	}
+	
+	return token_num > 0 ? (float)correct_num / token_num : 0.0;
+}
+
+// Fraction of heads in sentence_list that get their gold head with the
+// current arc_scorer and tree_decoder, and arc_filter if not NULL
+float evaluate_uas(ThreadPool *pool, Sentence **sentence_list, 
+                   int sentence_num, const ArcFilter *arc_filter)
+{
+	ParserContext *context_list = new ParserContext[pool->thread_num];
+	for(int i = 0;i < pool->thread_num;i++) 
+		context_list[i].arc_filter = arc_filter;
+	vector<vector<Edge> > result_list(sentence_num);
+	
+	decode_batch(pool, context_list, sentence_list, sentence_num, 
+	             &result_list[0], NULL);
+	
+	delete[] context_list;
+	
+	return get_uas(sentence_list, sentence_num, &result_list[0]);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Test code
+
+// Cheap but irregular arc score, so that the chart dominates decode time
+static float test_arc_weight(ParserContext *pc, Sentence *sent, 
+                             int head_index, int dep_index)
+{
+	unsigned int x = head_index * 7919U + dep_index * 104729U;
+	
+	x ^= x >> 13;
+	x *= 0x5BD1E995U;
+	x ^= x >> 15;
+	
+	return (float)(x % 1000) / 100.0;
+}
+
+static const ArcScorer test_arc_scorer = {NULL, test_arc_weight, NULL};
+
+// Time decoding of sentences of several lengths with every kernel the
+// CPU supports, and check that every token but ROOT gets one head, that
+// the tree score adds up, and that all kernels give the same tree
+// Returns the number of inconsistent trees
+int test_eisner()
+{
+	static const int length_list[] = {10, 20, 40, 80, 150, 300};
+	ArcScorer saved_scorer = arc_scorer;
+	ParserContext pc;
+	ArgmaxSumKernel saved_kernel = argmax_sum;
+	int error_num = 0;
+	
+	arc_scorer = test_arc_scorer;
+	
+	for(int i = 0;i < (int)(sizeof(length_list) / sizeof(int));i++)
+	{
+		Sentence sent;
+		sent.length = length_list[i];
+		
+		int n = sent.length;
+		int repeat = 2000000 / (n * n * n / 6 + 1) + 1;
+		vector<Edge> scalar_edge_list;
+		double scalar_time = 0.0;
+		
+		// The matrix is kept across kernels, so only the chart is timed
+		score_arcs(&pc, &sent);
+		
+		for(int kernel = 0;kernel < EISNER_KERNEL_NUM;kernel++)
+		{
+			if(!set_eisner_kernel(kernel)) continue;
+			
+			float score = 0.0;
+			double start_time = get_wall_time();
+			for(int j = 0;j < repeat;j++) score = eisner_decode_scored(&pc, &sent);
+			double elapsed = (get_wall_time() - start_time) / repeat;
+			
+			vector<int> head_count(n, 0);
+			float tree_score = 0.0;
+			for(int j = 0;j < pc.edge_list_index;j++)
+			{
+				head_count[pc.edge_list[j].dep_index]++;
+				tree_score += test_arc_weight(&pc, &sent, 
+				                              pc.edge_list[j].head_index, 
+				                              pc.edge_list[j].dep_index);
+			}
+			
+			bool valid = pc.edge_list_index == n - 1 && head_count[0] == 0 &&
+			             fabs(tree_score - score) < 1e-2;
+			for(int j = 1;j < n;j++) if(head_count[j] != 1) valid = false;
+			
+			if(kernel == EISNER_KERNEL_SCALAR)
+			{
+				scalar_edge_list.assign(pc.edge_list.begin(), 
+				                        pc.edge_list.begin() + pc.edge_list_index);
+				scalar_time = elapsed;
+			}
+			else
+			{
+				for(int j = 0;j < pc.edge_list_index;j++)
+				{
+					if(pc.edge_list[j].head_index != scalar_edge_list[j].head_index ||
+					   pc.edge_list[j].dep_index != scalar_edge_list[j].dep_index)
+						valid = false;
+				}
+			}
+			if(!valid) error_num++;
+			
+			DEBUG("Eisner: length %d, %s kernel, %.2f us/sentence (x%.2f), "
+			      "score %f, %s", n, get_eisner_kernel_name(kernel), 
+			      elapsed * 1e6, scalar_time / elapsed, score, 
+			      valid ? "valid" : "INVALID");
+		}
+	}
+	
+	arc_scorer = saved_scorer;
+	argmax_sum = saved_kernel;
+	
+	return error_num;
+}
+
+// Time the arc scoring stage and the chart stage separately on the first
+// max_sentence_num sentences of the corpus, with the current arc_scorer,
+// on a model with a random weight for every feature of them
+void profile_decode(int max_sentence_num)
+{
+	Context ctx;
+	ParserContext pc;
+	Sentence *sent;
+	vector<Sentence *> sentence_list;
+	double score_time = 0.0, decode_time = 0.0;
+	long arc_num = 0;
+	
+	while((int)sentence_list.size() < max_sentence_num && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		sentence_list.push_back(sent);
+	}
+	
+	int sentence_num = sentence_list.size();
+	clear_weight_table(&weight_vector);
+	add_random_weight(&sentence_list[0], sentence_num);
+	
+	for(int i = 0;i < sentence_num;i++)
+	{
+		sent = sentence_list[i];
+		
+		double start_time = get_wall_time();
+		score_arcs(&pc, sent);
+		double middle_time = get_wall_time();
+		eisner_decode_scored(&pc, sent);
+		
+		score_time += middle_time - start_time;
+		decode_time += get_wall_time() - middle_time;
+		arc_num += (long)(sent->length - 1) * (sent->length - 1);
+	}
+	
+	DEBUG("Decode %d sentences: scoring %.3f s (%.2f M arcs/s, %lu "
+	      "features), chart %.3f s", sentence_num, score_time, 
+	      arc_num / score_time / 1e6, weight_vector.size, decode_time);
+	clear_weight_table(&weight_vector);
+	
+	return;
+}
+
+// Number of sentences whose trees differ between a and b
+static int count_tree_mismatch(const vector<Edge> *a, const vector<Edge> *b,
+                               int sentence_num)
+{
+	int mismatch = 0;
+	
+	for(int i = 0;i < sentence_num;i++)
+	{
+		bool same = a[i].size() == b[i].size();
+		
+		for(size_t j = 0;same && j < a[i].size();j++)
+		{
+			if(a[i][j].head_index != b[i][j].head_index || 
+			   a[i][j].dep_index != b[i][j].dep_index) same = false;
+		}
+		if(!same) mismatch++;
+	}
+	
+	return mismatch;
+}
+
+// Decode the first max_sentence_num sentences of the corpus with one 
+// worker and with worker_num workers, report the throughput of both, and
+// check that they give the same trees. The model has a random weight for 
+// every feature of the sentences, so that trees are not decided by ties.
+// Returns the number of sentences whose trees differ
+int test_decode_batch(int max_sentence_num, int worker_num)
+{
+	Context ctx;
+	Sentence *sent;
+	vector<Sentence *> sentence_list;
+	
+	while((int)sentence_list.size() < max_sentence_num && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		sentence_list.push_back(sent);
+	}
+	
+	int sentence_num = sentence_list.size();
+	clear_weight_table(&weight_vector);
+	add_random_weight(&sentence_list[0], sentence_num);
+	
+	vector<vector<Edge> > result_list[2];
+	double elapsed[2];
+	int thread_num[2] = {1, worker_num};
+	
+	for(int i = 0;i < 2;i++)
+	{
+		ThreadPool pool(thread_num[i]);
+		ParserContext *context_list = new ParserContext[thread_num[i]];
+		
+		result_list[i].resize(sentence_num);
+		double start_time = get_wall_time();
+		decode_batch(&pool, context_list, &sentence_list[0], sentence_num,
+		             &result_list[i][0], NULL);
+		elapsed[i] = get_wall_time() - start_time;
+		
+		delete[] context_list;
+	}
+	
+	int mismatch = count_tree_mismatch(&result_list[0][0], &result_list[1][0],
+	                                   sentence_num);
+	
+	DEBUG("Batch decode %d sentences: 1 worker %.1f sent/s, %d workers "
+	      "%.1f sent/s (x%.2f), mismatch = %d", sentence_num, 
+	      sentence_num / elapsed[0], worker_num, sentence_num / elapsed[1], 
+	      elapsed[0] / elapsed[1], mismatch);
+	clear_weight_table(&weight_vector);
+	
+	return mismatch;
+}
+
+// Score arcs of long sentences, built by joining corpus sentences, with 
+// and without a pool of worker_num workers, on a model with a random 
+// weight for every feature of them. Both must give exactly the same 
+// matrix. Returns the number of arcs that differ
+int test_parallel_score(int worker_num)
+{
+	static const int length_list[] = {50, 100, 150, 200, 400};
+	static const int length_num = sizeof(length_list) / sizeof(int);
+	Context ctx;
+	Sentence *sent;
+	vector<unsigned int> word_list(1, ROOT_WORD_ID), pos_list(1, ROOT_POS_ID);
+	vector<unsigned int> five_gram_word_list(1, ROOT_WORD_ID);
+	vector<unsigned char> five_gram_flag(1, 0);
+	
+	while((int)word_list.size() < length_list[length_num - 1] && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		for(int i = 1;i < sent->length;i++)
+		{
+			word_list.push_back(sent->word_list[i]);
+			pos_list.push_back(sent->pos_list[i]);
+			five_gram_word_list.push_back(sent->five_gram_word_list[i]);
+			five_gram_flag.push_back(sent->five_gram_flag[i]);
+		}
+	}
+	
+	// One Sentence per length, all sharing the token arrays
+	Sentence long_sent_list[length_num];
+	Sentence *long_sent_pointer_list[length_num];
+	for(int i = 0;i < length_num;i++)
+	{
+		Sentence *long_sent = &long_sent_list[i];
+		
+		long_sent->length = min(length_list[i], (int)word_list.size());
+		long_sent->word_list = &word_list[0];
+		long_sent->pos_list = &pos_list[0];
+		long_sent->five_gram_word_list = &five_gram_word_list[0];
+		long_sent->five_gram_flag = &five_gram_flag[0];
+		long_sent_pointer_list[i] = long_sent;
+	}
+	
+	clear_weight_table(&weight_vector);
+	add_random_weight(long_sent_pointer_list, length_num);
+	
+	ThreadPool pool(worker_num);
+	ParserContext serial_pc, parallel_pc;
+	parallel_pc.score_pool = &pool;
+	parallel_pc.parallel_score_length = 0;
+	int mismatch = 0;
+	
+	for(int i = 0;i < length_num;i++)
+	{
+		Sentence *long_sent = &long_sent_list[i];
+		int n = long_sent->length;
+		double start_time = get_wall_time();
+		score_arcs(&serial_pc, long_sent);
+		double serial_time = get_wall_time() - start_time;
+		
+		start_time = get_wall_time();
+		score_arcs(&parallel_pc, long_sent);
+		double parallel_time = get_wall_time() - start_time;
+		
+		for(int head = 0;head < n;head++)
+		{
+			for(int modifier = 1;modifier < n;modifier++)
+			{
+				if(get_arc_score(&serial_pc.chart, head, modifier) != 
+				   get_arc_score(&parallel_pc.chart, head, modifier))
+					mismatch++;
+			}
+		}
+		
+		DEBUG("Parallel scoring: length %d, serial %.3f ms, %d workers "
+		      "%.3f ms (x%.2f)", n, serial_time * 1000.0, worker_num,
+		      parallel_time * 1000.0, serial_time / parallel_time);
+	}
+	
+	DEBUG("Parallel scoring: mismatch = %d", mismatch);
+	clear_weight_table(&weight_vector);
+	
+	return mismatch;
+}
+
+// Get a first order feature score one arc at a time from the generator, 
+// in-between features included, so O(n^3) per sentence
+static const ArcScorer generator_scorer = {
+	NULL, get_first_order_feature_score, NULL
+};
+
+// Decode sentence_num sentences after the first skip_sentence_num with
+// scorer and with generator_scorer, on the current model, and report the 
+// time and UAS of both. Scores only agree up to float rounding, so trees
+// could differ where two are within that of each other
+// Returns the number of sentences whose trees differ
+int test_scorer_parity(const ArcScorer *scorer, const char *name, 
+                       int skip_sentence_num, int sentence_num, 
+                       int worker_num)
+{
+	Context ctx;
+	Sentence *sent;
+	vector<Sentence *> sentence_list;
+	
+	// get_next_sentence() must not be called again once it returns NULL
+	bool has_more = true;
+	for(int i = 0;i < skip_sentence_num && has_more;i++) 
+		has_more = get_next_sentence(&ctx) != NULL;
+	while(has_more && (int)sentence_list.size() < sentence_num)
+	{
+		if((sent = get_next_sentence(&ctx)) == NULL) has_more = false;
+		else sentence_list.push_back(sent);
+	}
+	if(sentence_list.size() == 0) return 0;
+	
+	int num = sentence_list.size();
+	const ArcScorer *scorer_list[2] = {&generator_scorer, scorer};
+	ArcScorer saved_scorer = arc_scorer;
+	ThreadPool pool(worker_num);
+	ParserContext *context_list = new ParserContext[worker_num];
+	vector<vector<Edge> > result_list[2];
+	double elapsed[2];
+	float uas[2];
+	
+	for(int i = 0;i < 2;i++)
+	{
+		arc_scorer = *scorer_list[i];
+		result_list[i].resize(num);
+		
+		double start_time = get_wall_time();
+		decode_batch(&pool, context_list, &sentence_list[0], num, 
+		             &result_list[i][0], NULL);
+		elapsed[i] = get_wall_time() - start_time;
+		uas[i] = get_uas(&sentence_list[0], num, &result_list[i][0]);
+	}
+	arc_scorer = saved_scorer;
+	delete[] context_list;
+	
+	int mismatch = count_tree_mismatch(&result_list[0][0], 
+	                                   &result_list[1][0], num);
+	DEBUG("Scorer parity on %d sentences: generator %.3f s UAS %.4f, %s "
+	      "%.3f s UAS %.4f (x%.2f), mismatch = %d", num, elapsed[0], uas[0],
+	      name, elapsed[1], uas[1], elapsed[0] / elapsed[1], mismatch);
+	
+	return mismatch;
+}
+
+// Build an arc filter with min_gold_ratio from the first 
+// train_sentence_num sentences, then on the next test_sentence_num sentences report how many
+// arcs it prunes, how many gold arcs survive (oracle recall), and decode
+// time and UAS with and without it. Returns the oracle recall
+float test_arc_filter(int train_sentence_num, int test_sentence_num, 
+                      float min_gold_ratio, int worker_num)
+{
+	Context ctx;
+	Sentence *sent;
+	vector<Sentence *> train_list, test_list;
+	
+	while((int)train_list.size() < train_sentence_num && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		train_list.push_back(sent);
+	}
+	// Short of training sentences means get_next_sentence() has returned
+	// NULL, and it must not be called again
+	while((int)train_list.size() == train_sentence_num && 
+	      (int)test_list.size() < test_sentence_num && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		test_list.push_back(sent);
+	}
+	if(train_list.size() == 0 || test_list.size() == 0) return 0.0;
+	
+	ArcFilter filter;
+	build_arc_filter(&filter, &train_list[0], train_list.size(), 
+	                 min_gold_ratio);
+	
+	ParserContext pc;
+	pc.arc_filter = &filter;
+	long arc_num = 0, pruned_num = 0, gold_num = 0, gold_kept_num = 0;
+	for(int i = 0;i < (int)test_list.size();i++)
+	{
+		sent = test_list[i];
+		score_arcs(&pc, sent);
+		
+		for(int head = 0;head < sent->length;head++)
+		{
+			for(int modifier = 1;modifier < sent->length;modifier++)
+			{
+				if(head == modifier) continue;
+				arc_num++;
+				if(get_arc_score(&pc.chart, head, modifier) == -INFINITY) 
+					pruned_num++;
+			}
+		}
+		for(int j = 0;j < sent->gold_edge_num;j++)
+		{
+			gold_num++;
+			if(get_arc_score(&pc.chart, sent->gold_edge_list[j].head_index, 
+			                 sent->gold_edge_list[j].dep_index) != -INFINITY)
+				gold_kept_num++;
+		}
+	}
+	
+	ThreadPool pool(worker_num);
+	float uas[2];
+	double elapsed[2];
+	for(int i = 0;i < 2;i++)
+	{
+		double start_time = get_wall_time();
+		uas[i] = evaluate_uas(&pool, &test_list[0], test_list.size(), 
+		                      i == 0 ? NULL : &filter);
+		elapsed[i] = get_wall_time() - start_time;
+	}
+	
+	float recall = gold_num > 0 ? (float)gold_kept_num / gold_num : 0.0;
+	DEBUG("Arc filter from %d sentences, gold ratio %g: %d POS, %.1f%% of "
+	      "%ld arcs pruned, oracle recall %.4f", (int)train_list.size(), 
+	      min_gold_ratio, filter.pos_num, pruned_num * 100.0 / arc_num, 
+	      arc_num, recall);
+	DEBUG("Arc filter on %d sentences: full %.3f s UAS %.4f, pruned %.3f s "
+	      "UAS %.4f (x%.2f)", (int)test_list.size(), elapsed[0], uas[0], 
+	      elapsed[1], uas[1], elapsed[0] / elapsed[1]);
+	
+	return recall;
+}
+
+static float test_sibling_weight(ParserContext *pc, Sentence *sent, 
+                                 int head_index, int sib_index, int dep_index)
+{
+	unsigned int x = head_index * 7919U + sib_index * 15485863U + 
+	                 dep_index * 104729U;
+	
+	x ^= x >> 13;
+	x *= 0x5BD1E995U;
+	x ^= x >> 15;
+	
+	return (float)(x % 1000) / 200.0 - 2.0;
+}
+
+static float zero_sibling_weight(ParserContext *pc, Sentence *sent, 
+                                 int head_index, int sib_index, int dep_index)
+{
+	return 0.0;
+}
+
+// Score the tree in pc->edge_list with the current arc_scorer and 
+// sibling_weight, going through the modifiers of every head outward from
+// it. Returns -1 if it is not a tree over the sentence
+static float score_sibling_tree(ParserContext *pc, Sentence *sent)
+{
+	int n = sent->length;
+	vector<int> head_list(n, -1);
+	
+	if(pc->edge_list_index != n - 1) return -1.0;
+	for(int i = 0;i < pc->edge_list_index;i++)
+	{
+		int dep = pc->edge_list[i].dep_index;
+		if(dep == 0 || head_list[dep] != -1) return -1.0;
+		head_list[dep] = pc->edge_list[i].head_index;
+	}
+	
+	float score = 0.0;
+	for(int head = 0;head < n;head++)
+	{
+		int sib = head;
+		for(int dep = head + 1;dep < n;dep++)
+		{
+			if(head_list[dep] != head) continue;
+			score += arc_scorer.arc_weight(pc, sent, head, dep) + 
+			         sibling_weight(pc, sent, head, sib, dep);
+			sib = dep;
+		}
+		
+		sib = head;
+		for(int dep = head - 1;dep > 0;dep--)
+		{
+			if(head_list[dep] != head) continue;
+			score += arc_scorer.arc_weight(pc, sent, head, dep) + 
+			         sibling_weight(pc, sent, head, sib, dep);
+			sib = dep;
+		}
+	}
+	
+	return score;
+}
+
+// Check the second order decoder, then time it against the first order 
+// one on the first max_sentence_num sentences of the corpus:
+// - With random arc and sibling scores, the tree it returns must score
+//   what it says
+// - With sibling scores of 0, it must find trees as good as first order
+// Returns the number of sentences that fail
+int test_sibling_decode(int max_sentence_num)
+{
+	static const int length_list[] = {5, 10, 20, 40, 80, 250};
+	ArcScorer saved_scorer = arc_scorer;
+	float (*saved_sibling_weight)(ParserContext *, Sentence *, int, int, int) = 
+		sibling_weight;
+	ParserContext pc;
+	int error_num = 0;
+	
+	arc_scorer = test_arc_scorer;
+	for(int i = 0;i < (int)(sizeof(length_list) / sizeof(int));i++)
+	{
+		Sentence sent;
+		sent.length = length_list[i];
+		
+		sibling_weight = test_sibling_weight;
+		float score = sibling_decode(&pc, &sent);
+		float tree_score = score_sibling_tree(&pc, &sent);
+		if(fabs(tree_score - score) > 1e-2) error_num++;
+		
+		sibling_weight = zero_sibling_weight;
+		float second_order_score = sibling_decode(&pc, &sent);
+		float first_order_score = eisner_decode(&pc, &sent);
+		if(fabs(first_order_score - second_order_score) > 1e-2) error_num++;
+		
+		DEBUG("Sibling decode: length %d, score %f, tree %f, "
+		      "first order %f, no sibling %f", sent.length, score, 
+		      tree_score, first_order_score, second_order_score);
+	}
+	arc_scorer = saved_scorer;
+	sibling_weight = saved_sibling_weight;
+	
+	Context ctx;
+	Sentence *sent;
+	double first_order_time = 0.0, arc_time = 0.0, part_time = 0.0;
+	double chart_time = 0.0;
+	long part_num = 0;
+	int sentence_num = 0;
+	
+	while(sentence_num < max_sentence_num && 
+	      (sent = get_next_sentence(&ctx)) != NULL)
+	{
+		double start_time = get_wall_time();
+		eisner_decode(&pc, sent);
+		first_order_time += get_wall_time() - start_time;
+		
+		start_time = get_wall_time();
+		score_arcs(&pc, sent);
+		double arc_end_time = get_wall_time();
+		score_sibling_parts(&pc, sent);
+		double part_end_time = get_wall_time();
+		sibling_decode_scored(&pc, sent);
+		
+		arc_time += arc_end_time - start_time;
+		part_time += part_end_time - arc_end_time;
+		chart_time += get_wall_time() - part_end_time;
+		part_num += pc.sibling_chart.part_score.size();
+		sentence_num++;
+	}
+	
+	double second_order_time = arc_time + part_time + chart_time;
+	DEBUG("Sibling decode %d sentences: first order %.3f s, second order "
+	      "%.3f s (x%.2f): arcs %.3f s, %ld sibling parts %.3f s, "
+	      "chart %.3f s", sentence_num, first_order_time, second_order_time, 
+	      second_order_time / first_order_time, arc_time, part_num, 
+	      part_time, chart_time);
+	DEBUG("Sibling decode: %d errors", error_num);
+	
+	return error_num;
+}
@@ -0,0 +1,222 @@
+#include "glm_parser.h"
+
+// Quantized weights for inference
+//
+// A float WeightTable entry takes 16 bytes (key, weight, type) at a load
+// of at most 0.5. Here an entry is 4 bytes: a 16-bit fingerprint of the
+// key and a 16 or 8-bit value. Values are scaled per feature type, the 
+// type value hashed into every key, which add_weight() records in the
+// float table. Only non-zero weights are kept
+
+QuantizedModel quantized_model;
+
+QuantizedModel::QuantizedModel()
+{
+    format = QUANT_FP16;
+    capacity = QUANT_MIN_CAPACITY;
+    mask = capacity - 1;
+    shift = 64 - 10;
+    size = 0;
+    empty_key_weight = 0.0;
+    
+    entry_list = (QuantizedEntry *)calloc(capacity, sizeof(QuantizedEntry));
+    if(entry_list == NULL) ERROR("Allocate quantized model fails!", 0);
+    
+    for(int i = 0;i < QUANT_TYPE_NUM;i++) scale_list[i] = 1.0;
+}
+
+QuantizedModel::~QuantizedModel()
+{
+    free(entry_list);
+}
+
+// Round to nearest. Subnormals are flushed to zero; values passed in are
+// at most 1.0 in magnitude, so there is no overflow
+static uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    if(exponent <= 0) return sign;
+    if(exponent >= 31) return sign | 0x7C00;
+    
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    // A carry out of the mantissa correctly bumps the exponent
+    if(mantissa & 0x1000) half++;
+    
+    return half;
+}
+
+// Weight of slot i as the table is currently read, raw or averaged
+static float get_entry_weight(const WeightTable *table, unsigned long i)
+{
+    return table->use_average ? table->sum_list[i] : table->entry_list[i].weight;
+}
+
+// Rebuild model from table in the given format
+void quantize_model(QuantizedModel *model, const WeightTable *table, 
+                    int format)
+{
+    float max_list[QUANT_TYPE_NUM] = {0.0};
+    
+    for(unsigned long i = 0;i < table->capacity;i++)
+    {
+        const WeightEntry *entry = &table->entry_list[i];
+        if(entry->key == WEIGHT_EMPTY_KEY) continue;
+        if(entry->type >= QUANT_TYPE_NUM) 
+            ERROR("Feature type %u cannot be quantized", entry->type);
+        
+        float weight = fabs(get_entry_weight(table, i));
+        if(weight > max_list[entry->type]) max_list[entry->type] = weight;
+    }
+    
+    // fp16 values are kept within [-1, 1] too, so that they never overflow
+    for(int i = 0;i < QUANT_TYPE_NUM;i++)
+    {
+        if(max_list[i] == 0.0) model->scale_list[i] = 1.0;
+        else if(format == QUANT_INT8) model->scale_list[i] = max_list[i] / 127.0;
+        else model->scale_list[i] = max_list[i];
+    }
+    
+    // Quantize first, so that weights that become 0 take no slot
+    vector<unsigned long> key_list;
+    vector<uint16_t> value_list;
+    for(unsigned long i = 0;i < table->capacity;i++)
+    {
+        const WeightEntry *entry = &table->entry_list[i];
+        if(entry->key == WEIGHT_EMPTY_KEY) continue;
+        
+        float value = get_entry_weight(table, i) / model->scale_list[entry->type];
+        uint16_t quantized;
+        
+        if(format == QUANT_INT8) 
+            quantized = (uint8_t)(int8_t)lrintf(value);
+        else 
+            quantized = float_to_half(value);
+        
+        // +0 and -0 in either format
+        if((quantized & 0x7FFF) == 0 || 
+           (format == QUANT_INT8 && quantized == 0)) continue;
+        
+        key_list.push_back(entry->key);
+        value_list.push_back(quantized);
+    }
+    
+    unsigned long real_capacity = QUANT_MIN_CAPACITY;
+    int bit_num = 10;
+    while(key_list.size() > real_capacity * QUANT_MAX_LOAD_FACTOR) 
+    {
+        real_capacity <<= 1;
+        bit_num++;
+    }
+    
+    free(model->entry_list);
+    model->entry_list = 
+        (QuantizedEntry *)calloc(real_capacity, sizeof(QuantizedEntry));
+    if(model->entry_list == NULL) 
+        ERROR("Allocate quantized model of %lu entries fails!", real_capacity);
+    
+    model->format = format;
+    model->capacity = real_capacity;
+    model->mask = real_capacity - 1;
+    model->shift = 64 - bit_num;
+    model->size = 0;
+    model->empty_key_weight = get_table_weight(table, WEIGHT_EMPTY_KEY);
+    
+    // A key whose probe sequence meets its own fingerprint first could 
+    // never be found. Such keys are dropped; their number is reported
+    unsigned long shadowed_num = 0;
+    for(unsigned long i = 0;i < key_list.size();i++)
+    {
+        uint64_t mixed = (uint64_t)key_list[i] * 0x9E3779B97F4A7C15ULL;
+        unsigned long slot = (unsigned long)(mixed >> model->shift);
+        uint16_t fingerprint = get_quantized_fingerprint(mixed, model->shift);
+        
+        while(model->entry_list[slot].fingerprint != 0 &&
+              model->entry_list[slot].fingerprint != fingerprint)
+            slot = (slot + 1) & model->mask;
+        
+        if(model->entry_list[slot].fingerprint == fingerprint) 
+        {
+            shadowed_num++;
+            continue;
+        }
+        
+        model->entry_list[slot].fingerprint = fingerprint;
+        model->entry_list[slot].value = value_list[i];
+        model->size++;
+    }
+    
+    DEBUG("Quantized %s: %lu of %lu features kept, %lu shadowed, "
+          "%.1f MB (float table %.1f MB)", 
+          format == QUANT_INT8 ? "int8" : "fp16", model->size, table->size,
+          shadowed_num, 
+          model->capacity * sizeof(QuantizedEntry) / 1048576.0,
+          table->capacity * sizeof(WeightEntry) / 1048576.0);
+    
+    return;
+}
+
+// Quantize weight_vector to fp16 and int8, and compare the UAS of both 
+// with that of the float weights on sentence_num sentences that come
+// after the first skip_sentence_num (e.g. the ones trained on). Arc and
+// sibling weights are both quantized, so this works with either 
+// tree_decoder
+// Returns the number of sentences decoded
+int report_quantized_uas(int skip_sentence_num, int sentence_num, 
+                         int worker_num)
+{
+    Context ctx;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    // get_next_sentence() must not be called again once it returns NULL
+    bool has_more = true;
+    for(int i = 0;i < skip_sentence_num && has_more;i++) 
+        has_more = get_next_sentence(&ctx) != NULL;
+    while(has_more && (int)sentence_list.size() < sentence_num)
+    {
+        if((sent = get_next_sentence(&ctx)) == NULL) has_more = false;
+        else sentence_list.push_back(sent);
+    }
+    if(sentence_list.size() == 0) return 0;
+    
+    ArcScorer saved_scorer = arc_scorer;
+    float (*saved_sibling_weight)(ParserContext *, Sentence *, int, int, int) = 
+        sibling_weight;
+    ThreadPool pool(worker_num);
+    
+    arc_scorer = first_order_scorer;
+    sibling_weight = get_sibling_feature_score;
+    double start_time = get_wall_time();
+    float float_uas = evaluate_uas(&pool, &sentence_list[0], 
+                                   sentence_list.size());
+    double float_time = get_wall_time() - start_time;
+    
+    arc_scorer = quantized_scorer;
+    sibling_weight = get_quantized_sibling_score;
+    static const int format_list[] = {QUANT_FP16, QUANT_INT8};
+    for(int i = 0;i < 2;i++)
+    {
+        quantize_model(&quantized_model, &weight_vector, format_list[i]);
+        
+        start_time = get_wall_time();
+        float uas = evaluate_uas(&pool, &sentence_list[0], 
+                                 sentence_list.size());
+        double elapsed = get_wall_time() - start_time;
+        
+        DEBUG("Held out %d sentences: float UAS %.4f (%.3f s), %s UAS %.4f "
+              "(%.3f s), delta %+.4f", (int)sentence_list.size(), float_uas, 
+              float_time, format_list[i] == QUANT_INT8 ? "int8" : "fp16", 
+              uas, elapsed, uas - float_uas);
+    }
+    
+    arc_scorer = saved_scorer;
+    sibling_weight = saved_sibling_weight;
+    
+    return sentence_list.size();
+}
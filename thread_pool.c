@@ -0,0 +1,99 @@
+#include "glm_parser.h"
+
+// A fixed size pool of worker threads that runs parallel for loops.
+// The thread calling run() also works as worker 0, so a pool of size 1
+// does not create any thread and runs everything inline
+ThreadPool::ThreadPool(int pthread_num)
+{
+    if(pthread_num < 1) ERROR("Invalid worker count: %d", pthread_num);
+    
+    thread_num = pthread_num;
+    current_task = NULL;
+    task_num = 0;
+    next_task = 0;
+    generation = 0;
+    busy_worker_num = 0;
+    stopping = false;
+    
+    for(int i = 1;i < thread_num;i++)
+    {
+        thread_list.push_back(thread(&ThreadPool::worker_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        unique_lock<mutex> guard(lock);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    
+    for(int i = 0;i < (int)thread_list.size();i++) thread_list[i].join();
+}
+
+// Grab task indices until there is none left
+void ThreadPool::execute_tasks(int worker_index)
+{
+    int task_index;
+    
+    while((task_index = next_task.fetch_add(1)) < task_num)
+    {
+        (*current_task)(task_index, worker_index);
+    }
+    
+    return;
+}
+
+void ThreadPool::worker_loop(int worker_index)
+{
+    int seen_generation = 0;
+    
+    while(1)
+    {
+        unique_lock<mutex> guard(lock);
+        start_cv.wait(guard, [&] { 
+            return stopping || generation != seen_generation; 
+        });
+        if(stopping) return;
+        
+        seen_generation = generation;
+        guard.unlock();
+        
+        execute_tasks(worker_index);
+        
+        guard.lock();
+        if(--busy_worker_num == 0) finish_cv.notify_all();
+    }
+}
+
+// Calls task(task_index, worker_index) for every task_index in [0, ptask_num)
+// and returns after all of them have finished. Tasks are handed out
+// dynamically in increasing order, and worker_index is in [0, thread_num)
+void ThreadPool::run(int ptask_num, const function<void (int, int)> &task)
+{
+    if(thread_num == 1)
+    {
+        for(int i = 0;i < ptask_num;i++) task(i, 0);
+        
+        return;
+    }
+    
+    {
+        unique_lock<mutex> guard(lock);
+        current_task = &task;
+        task_num = ptask_num;
+        next_task = 0;
+        busy_worker_num = thread_num - 1;
+        generation++;
+    }
+    start_cv.notify_all();
+    
+    execute_tasks(0);
+    
+    unique_lock<mutex> guard(lock);
+    finish_cv.wait(guard, [&] { return busy_worker_num == 0; });
+    current_task = NULL;
+    
+    return;
+}
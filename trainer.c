@@ -0,0 +1,486 @@
+#include "glm_parser.h"
+
+// Structured perceptron training with iterative parameter mixing
+//
+// Sentences are split into worker_num contiguous shards. In every epoch
+// each shard runs the perceptron over its sentences, with its updates 
+// kept in its own delta table on top of the shared weight_vector, which
+// is only read during the epoch. At the end of the epoch the deltas are
+// averaged into weight_vector, in shard order
+//
+// Which thread runs a shard does not matter, so for a fixed worker_num 
+// the result is always the same
+//
+// In second order training, trees are decoded by sibling_decode() and 
+// sibling parts (head, sib, dep) are updated along with arcs
+
+// Features of every gold arc of a sentence, extracted once before the
+// first epoch. Those of gold_edge_list[i] are hash_list[offset_list[i],
+// offset_list[i + 1])
+struct GoldFeature
+{
+    vector<unsigned long> hash_list;
+    vector<unsigned short> type_list;
+    vector<int> offset_list;
+};
+
+struct TrainShard
+{
+    ParserContext pc;
+    WeightTable delta_table;
+    
+    Sentence **sentence_list;
+    int sentence_num;
+    vector<GoldFeature> gold_feature_list;
+    
+    vector<int> head_list;
+    vector<unsigned long> feature_buffer;   // For predicted arcs
+    vector<unsigned short> type_buffer;
+    
+    bool second_order;
+    vector<int> gold_head_list;
+    vector<long> gold_part_list;            // See get_sibling_part_list()
+    vector<long> predicted_part_list;
+    
+    // If not NULL, only features counted at least feature_cutoff times
+    // in gold trees are updated
+    const CountSketch *sketch;
+    int feature_cutoff;
+    long correct_num;
+    long token_num;
+};
+
+static void extract_gold_feature(TrainShard *shard)
+{
+    shard->gold_feature_list.resize(shard->sentence_num);
+    
+    for(int i = 0;i < shard->sentence_num;i++)
+    {
+        Sentence *sent = shard->sentence_list[i];
+        GoldFeature *gold = &shard->gold_feature_list[i];
+        
+        if((int)shard->feature_buffer.size() < 
+           MAX_FIRST_ORDER_FEATURE_NUM(sent->length))
+        {
+            shard->feature_buffer.resize(MAX_FIRST_ORDER_FEATURE_NUM(sent->length));
+            shard->type_buffer.resize(shard->feature_buffer.size());
+        }
+        
+        gold->offset_list.assign(1, 0);
+        for(int j = 0;j < sent->gold_edge_num;j++)
+        {
+            int num = extract_first_order_feature(
+                &shard->pc, sent, sent->gold_edge_list[j].head_index, 
+                sent->gold_edge_list[j].dep_index, &shard->feature_buffer[0],
+                &shard->type_buffer[0], shard->feature_buffer.size());
+            
+            gold->hash_list.insert(gold->hash_list.end(), 
+                                   shard->feature_buffer.begin(), 
+                                   shard->feature_buffer.begin() + num);
+            gold->type_list.insert(gold->type_list.end(), 
+                                   shard->type_buffer.begin(), 
+                                   shard->type_buffer.begin() + num);
+            gold->offset_list.push_back(gold->hash_list.size());
+        }
+        gold->hash_list.shrink_to_fit();
+        gold->type_list.shrink_to_fit();
+    }
+    
+    return;
+}
+
+// Drop features of num in hash_list and type_list that are under the 
+// cutoff. Returns how many are left
+static int apply_feature_cutoff(const TrainShard *shard, 
+                                unsigned long *hash_list, 
+                                unsigned short *type_list, int num)
+{
+    int kept_num = 0;
+    
+    for(int i = 0;i < num;i++)
+    {
+        if(query_count_sketch(shard->sketch, hash_list[i]) < 
+           (unsigned int)shard->feature_cutoff) continue;
+        
+        hash_list[kept_num] = hash_list[i];
+        type_list[kept_num] = type_list[i];
+        kept_num++;
+    }
+    
+    return kept_num;
+}
+
+static void apply_gold_feature_cutoff(TrainShard *shard)
+{
+    for(int i = 0;i < shard->sentence_num;i++)
+    {
+        GoldFeature *gold = &shard->gold_feature_list[i];
+        int kept_num = 0;
+        
+        for(int j = 0;j + 1 < (int)gold->offset_list.size();j++)
+        {
+            int begin = gold->offset_list[j];
+            unsigned long *hash_list = gold->hash_list.data();
+            unsigned short *type_list = gold->type_list.data();
+            int num = apply_feature_cutoff(shard, hash_list + begin, 
+                                           type_list + begin,
+                                           gold->offset_list[j + 1] - begin);
+            
+            // Arcs are moved down over what was dropped before them
+            memmove(hash_list + kept_num, hash_list + begin, 
+                    num * sizeof(unsigned long));
+            memmove(type_list + kept_num, type_list + begin, 
+                    num * sizeof(unsigned short));
+            gold->offset_list[j] = kept_num;
+            kept_num += num;
+        }
+        
+        gold->offset_list.back() = kept_num;
+        gold->hash_list.resize(kept_num);
+        gold->type_list.resize(kept_num);
+        gold->hash_list.shrink_to_fit();
+        gold->type_list.shrink_to_fit();
+    }
+    
+    return;
+}
+
+// Sibling parts of the tree given by head_list, each one encoded as 
+// (head * n + sib) * n + dep, in increasing order. Modifiers of a head 
+// are taken outward from it on either side, the first one with sib = head
+static void get_sibling_part_list(const int *head_list, int n, 
+                                  vector<long> *part_list)
+{
+    part_list->clear();
+    for(int head = 0;head < n;head++)
+    {
+        int sib = head;
+        for(int dep = head + 1;dep < n;dep++)
+        {
+            if(head_list[dep] != head) continue;
+            part_list->push_back(((long)head * n + sib) * n + dep);
+            sib = dep;
+        }
+        
+        sib = head;
+        for(int dep = head - 1;dep > 0;dep--)
+        {
+            if(head_list[dep] != head) continue;
+            part_list->push_back(((long)head * n + sib) * n + dep);
+            sib = dep;
+        }
+    }
+    
+    sort(part_list->begin(), part_list->end());
+    
+    return;
+}
+
+static void get_gold_sibling_part_list(TrainShard *shard, Sentence *sent)
+{
+    shard->gold_head_list.assign(sent->length, -1);
+    for(int i = 0;i < sent->gold_edge_num;i++)
+        shard->gold_head_list[sent->gold_edge_list[i].dep_index] = 
+            sent->gold_edge_list[i].head_index;
+    
+    get_sibling_part_list(&shard->gold_head_list[0], sent->length, 
+                          &shard->gold_part_list);
+    
+    return;
+}
+
+// Add features of an encoded sibling part into the shard's delta table
+static void update_sibling_part(TrainShard *shard, Sentence *sent, long part,
+                                float delta)
+{
+    int n = sent->length;
+    int num = extract_sibling_feature(
+        &shard->pc, sent, part / n / n, part / n % n, part % n, 
+        &shard->feature_buffer[0], &shard->type_buffer[0], 
+        shard->feature_buffer.size());
+    
+    if(shard->sketch != NULL)
+        num = apply_feature_cutoff(shard, &shard->feature_buffer[0], 
+                                   &shard->type_buffer[0], num);
+    add_feature_vector(&shard->delta_table, &shard->feature_buffer[0],
+                       &shard->type_buffer[0], num, delta);
+    
+    return;
+}
+
+// Reward sibling parts that are only in the gold tree, and penalize those
+// that are only in the predicted one
+static void train_sibling_part(TrainShard *shard, Sentence *sent)
+{
+    const vector<long> &gold = shard->gold_part_list;
+    const vector<long> &predicted = shard->predicted_part_list;
+    size_t i = 0, j = 0;
+    
+    get_gold_sibling_part_list(shard, sent);
+    get_sibling_part_list(&shard->head_list[0], sent->length, 
+                          &shard->predicted_part_list);
+    
+    while(i < gold.size() || j < predicted.size())
+    {
+        if(j == predicted.size() || 
+           (i < gold.size() && gold[i] < predicted[j]))
+            update_sibling_part(shard, sent, gold[i++], 1.0);
+        else if(i == gold.size() || predicted[j] < gold[i])
+            update_sibling_part(shard, sent, predicted[j++], -1.0);
+        else 
+        {
+            i++;
+            j++;
+        }
+    }
+    
+    return;
+}
+
+// Count features of the gold sibling parts of a sentence into sketch
+static void count_gold_sibling_feature(TrainShard *shard, int sentence_index,
+                                       CountSketch *sketch)
+{
+    Sentence *sent = shard->sentence_list[sentence_index];
+    int n = sent->length;
+    
+    get_gold_sibling_part_list(shard, sent);
+    for(size_t i = 0;i < shard->gold_part_list.size();i++)
+    {
+        long part = shard->gold_part_list[i];
+        int num = extract_sibling_feature(
+            &shard->pc, sent, part / n / n, part / n % n, part % n,
+            &shard->feature_buffer[0], NULL, shard->feature_buffer.size());
+        
+        for(int k = 0;k < num;k++) 
+            add_count_sketch(sketch, shard->feature_buffer[k]);
+    }
+    
+    return;
+}
+
+// One perceptron step: decode, and if the tree is wrong, reward features
+// of the gold arcs and penalize those of the predicted ones. Arcs that 
+// are in both trees would cancel out, so they are skipped, and so are 
+// sibling parts in second order training
+static void train_sentence(TrainShard *shard, int sentence_index)
+{
+    Sentence *sent = shard->sentence_list[sentence_index];
+    const GoldFeature *gold = &shard->gold_feature_list[sentence_index];
+    ParserContext *pc = &shard->pc;
+    int n = sent->length;
+    
+    if(shard->second_order) sibling_decode(pc, sent);
+    else eisner_decode(pc, sent);
+    
+    vector<int> &head_list = shard->head_list;
+    head_list.assign(n, -1);
+    for(int i = 0;i < pc->edge_list_index;i++)
+        head_list[pc->edge_list[i].dep_index] = pc->edge_list[i].head_index;
+    
+    for(int i = 0;i < sent->gold_edge_num;i++)
+    {
+        int head = sent->gold_edge_list[i].head_index;
+        int dep = sent->gold_edge_list[i].dep_index;
+        
+        if(head_list[dep] == head)
+        {
+            shard->correct_num++;
+            continue;
+        }
+        
+        add_feature_vector(&shard->delta_table, 
+                           &gold->hash_list[gold->offset_list[i]],
+                           &gold->type_list[gold->offset_list[i]],
+                           gold->offset_list[i + 1] - gold->offset_list[i],
+                           1.0);
+        if(head_list[dep] >= 0)
+        {
+            int num = extract_first_order_feature(
+                pc, sent, head_list[dep], dep, &shard->feature_buffer[0], 
+                &shard->type_buffer[0], shard->feature_buffer.size());
+            if(shard->sketch != NULL)
+                num = apply_feature_cutoff(shard, &shard->feature_buffer[0], 
+                                           &shard->type_buffer[0], num);
+            add_feature_vector(&shard->delta_table, &shard->feature_buffer[0],
+                               &shard->type_buffer[0], num, -1.0);
+        }
+    }
+    
+    if(shard->second_order) train_sibling_part(shard, sent);
+    shard->token_num += sent->gold_edge_num;
+    
+    return;
+}
+
+// Train weight_vector from scratch on the first max_sentence_num (or all,
+// if it is not positive) sentences, with worker_num shards and threads
+// Returns the fraction of correct heads seen in the last epoch
+//
+// With feature_cutoff > 0, gold tree features are counted in a count-min
+// sketch of sketch_size bytes before the first epoch, and only features 
+// counted at least feature_cutoff times ever get a weight. Features that
+// never occur in a gold tree are kept out as well
+//
+// With average, weight_vector is left with averaged weights switched on
+// Unless model_path is empty, the model is then saved there with 
+// save_model(), to be mapped by map_model() for parsing
+//
+// With second_order, sibling features are trained as well. Parse with
+// tree_decoder set to sibling_decode() to use them
+// Time steps are sentences: shards keep running sums of their deltas
+// over their own steps, and weight_vector over epochs (each epoch is 
+// sentence_num steps during which it does not change). Merging adds the
+// delta sums in, so the result is the average over all steps of the 
+// weights each shard decoded with. Every update only touches the sums of
+// the features it changes
+float train_perceptron(int epoch_num, int worker_num, int max_sentence_num,
+                       bool average, int feature_cutoff, 
+                       unsigned long sketch_size, string model_path, 
+                       bool second_order)
+{
+    Context ctx;
+    Sentence *sent;
+    vector<Sentence *> sentence_list;
+    
+    while((max_sentence_num <= 0 || 
+           (int)sentence_list.size() < max_sentence_num) && 
+          (sent = get_next_sentence(&ctx)) != NULL)
+    {
+        sentence_list.push_back(sent);
+    }
+    
+    int sentence_num = sentence_list.size();
+    if(sentence_num == 0) ERROR("No sentence to train on", 0);
+    if(worker_num > sentence_num) worker_num = sentence_num;
+    
+    clear_weight_table(&weight_vector);
+    if(average) enable_weight_average(&weight_vector);
+    
+    ThreadPool pool(worker_num);
+    TrainShard *shard_list = new TrainShard[worker_num];
+    for(int i = 0;i < worker_num;i++)
+    {
+        int begin = (long)sentence_num * i / worker_num;
+        int end = (long)sentence_num * (i + 1) / worker_num;
+        
+        shard_list[i].sentence_list = &sentence_list[begin];
+        shard_list[i].sentence_num = end - begin;
+        shard_list[i].pc.delta_table = &shard_list[i].delta_table;
+        shard_list[i].sketch = NULL;
+        shard_list[i].feature_cutoff = feature_cutoff;
+        shard_list[i].second_order = second_order;
+        if(average) enable_weight_average(&shard_list[i].delta_table);
+    }
+    
+    double start_time = get_wall_time();
+    pool.run(worker_num, [&](int task_index, int worker_index) {
+        extract_gold_feature(&shard_list[task_index]);
+    });
+    
+    long gold_feature_num = 0;
+    for(int i = 0;i < worker_num;i++)
+        for(int j = 0;j < shard_list[i].sentence_num;j++)
+            gold_feature_num += shard_list[i].gold_feature_list[j].hash_list.size();
+    DEBUG("Gold features: %ld extracted in %.3f s (%.1f MB)", 
+          gold_feature_num, get_wall_time() - start_time, 
+          gold_feature_num * sizeof(unsigned long) / 1048576.0);
+    
+    // Counted in shard order, so that the sketch is the same every time
+    CountSketch sketch;
+    if(feature_cutoff > 0)
+    {
+        start_time = get_wall_time();
+        init_count_sketch(&sketch, sketch_size, SKETCH_DEPTH);
+        for(int i = 0;i < worker_num;i++)
+        {
+            for(int j = 0;j < shard_list[i].sentence_num;j++)
+            {
+                const vector<unsigned long> &hash_list = 
+                    shard_list[i].gold_feature_list[j].hash_list;
+                for(int k = 0;k < (int)hash_list.size();k++) 
+                    add_count_sketch(&sketch, hash_list[k]);
+                
+                if(second_order) 
+                    count_gold_sibling_feature(&shard_list[i], j, &sketch);
+            }
+        }
+        
+        pool.run(worker_num, [&](int task_index, int worker_index) {
+            shard_list[task_index].sketch = &sketch;
+            apply_gold_feature_cutoff(&shard_list[task_index]);
+        });
+        
+        long kept_num = 0;
+        for(int i = 0;i < worker_num;i++)
+            for(int j = 0;j < shard_list[i].sentence_num;j++)
+                kept_num += shard_list[i].gold_feature_list[j].hash_list.size();
+        DEBUG("Feature cutoff %d: sketch %d x %lu (%.1f MB), %ld of %ld gold "
+              "features kept, %.3f s", feature_cutoff, sketch.depth, 
+              sketch.width, sketch.depth * sketch.width * 2 / 1048576.0, 
+              kept_num, gold_feature_num, get_wall_time() - start_time);
+    }
+    
+    float accuracy = 0.0;
+    for(int epoch = 0;epoch < epoch_num;epoch++)
+    {
+        double start_time = get_wall_time();
+        
+        pool.run(worker_num, [&](int task_index, int worker_index) {
+            TrainShard *shard = &shard_list[task_index];
+            
+            shard->correct_num = shard->token_num = 0;
+            for(int i = 0;i < shard->sentence_num;i++)
+            {
+                shard->delta_table.average_time = i;
+                train_sentence(shard, i);
+            }
+            shard->delta_table.average_time = shard->sentence_num;
+        });
+        
+        long correct_num = 0, token_num = 0;
+        weight_vector.average_time = (epoch + 1) * sentence_num;
+        for(int i = 0;i < worker_num;i++)
+        {
+            merge_weight_table(&weight_vector, &shard_list[i].delta_table, 
+                               1.0 / worker_num);
+            clear_weight_table(&shard_list[i].delta_table);
+            
+            correct_num += shard_list[i].correct_num;
+            token_num += shard_list[i].token_num;
+        }
+        
+        double elapsed = get_wall_time() - start_time;
+        accuracy = token_num > 0 ? (float)correct_num / token_num : 0.0;
+        
+        DEBUG("Epoch %d: %.3f s, %.1f sent/s, train UAS %.4f, %lu features",
+              epoch + 1, elapsed, sentence_num / elapsed, accuracy, 
+              weight_vector.size);
+    }
+    
+    delete[] shard_list;
+    
+    if(average)
+    {
+        double start_time = get_wall_time();
+        finalize_weight_average(&weight_vector);
+        double finalize_time = get_wall_time() - start_time;
+        
+        float (*saved_tree_decoder)(ParserContext *, Sentence *) = 
+            tree_decoder;
+        if(second_order) tree_decoder = sibling_decode;
+        float raw_accuracy = evaluate_uas(&pool, &sentence_list[0], 
+                                          sentence_num);
+        set_weight_average(&weight_vector, true);
+        float average_accuracy = evaluate_uas(&pool, &sentence_list[0], 
+                                              sentence_num);
+        tree_decoder = saved_tree_decoder;
+        
+        DEBUG("Averaged in %.3f s, train UAS raw %.4f, averaged %.4f", 
+              finalize_time, raw_accuracy, average_accuracy);
+    }
+    
+    if(!model_path.empty()) save_model(&weight_vector, model_path);
+    
+    return accuracy;
+}
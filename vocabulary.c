@@ -0,0 +1,99 @@
+#include "glm_parser.h"
+
+// All words, POS tags and five gram prefixes share one ID space
+Vocabulary vocabulary;
+
+// Reserved tokens. Their IDs are fixed, see ROOT_WORD_ID etc.
+static const char *reserved_token_list[RESERVED_TOKEN_NUM] = 
+{
+    "__ROOT__",     // ROOT_WORD_ID
+    "ROOT",         // ROOT_POS_ID
+    "__INV__",      // INVALID_WORD_ID
+    "_N_",          // NULL_POS_ID
+};
+
+Vocabulary::Vocabulary()
+{
+    token_num = 0;
+    for(int i = 0;i < VOCAB_CHUNK_NUM;i++) chunk_list[i] = NULL;
+    
+    for(int i = 0;i < RESERVED_TOKEN_NUM;i++)
+    {
+        const char *token = reserved_token_list[i];
+        intern_token(this, token, strlen(token));
+    }
+}
+
+Vocabulary::~Vocabulary()
+{
+    clear_vocabulary(this);
+}
+
+// Returns the ID of the token, and allocates a new one if it is not
+// seen before. IDs are dense and assigned in order of first appearance
+unsigned int intern_token(Vocabulary *vocab, const char *str, int len)
+{
+    string token(str, len);
+    
+    unordered_map<string, unsigned int>::iterator it = vocab->index.find(token);
+    if(it != vocab->index.end()) return it->second;
+    
+    unsigned int id = vocab->token_num;
+    
+    // First ID of a chunk: allocate it before the entry is written
+    unsigned int biased_id = id + (1U << VOCAB_FIRST_CHUNK_BITS);
+    if((biased_id & (biased_id - 1)) == 0)
+    {
+        int chunk_index = 31 - __builtin_clz(biased_id) - VOCAB_FIRST_CHUNK_BITS;
+        if(chunk_index >= VOCAB_CHUNK_NUM) ERROR("Vocabulary is full: %u", id);
+        
+        vocab->chunk_list[chunk_index] = new VocabularyEntry[biased_id];
+    }
+    
+    VocabularyEntry *entry = get_vocabulary_entry(vocab, id);
+    entry->token = token;
+    entry->token_hash.hash = 0;
+    entry->token_hash.power = 1;
+    for(int i = 0;i < len;i++)
+    {
+        entry->token_hash.hash = 
+            entry->token_hash.hash * HASH_MULTIPLIER + (unsigned char)str[i];
+        entry->token_hash.power *= HASH_MULTIPLIER;
+    }
+    
+    vocab->index[token] = id;
+    vocab->token_num++;
+    
+    return id;
+}
+
+// Intern all tokens of local into vocab, in the order of their local IDs
+// id_map is filled such that id_map[local ID] = ID in vocab
+void merge_vocabulary(Vocabulary *vocab, Vocabulary *local, 
+                      vector<unsigned int> *id_map)
+{
+    id_map->resize(local->token_num);
+    
+    for(unsigned int i = 0;i < local->token_num;i++)
+    {
+        string *token = &get_vocabulary_entry(local, i)->token;
+        (*id_map)[i] = intern_token(vocab, token->c_str(), token->length());
+    }
+    
+    return;
+}
+
+// Release all memory of the vocabulary, including the reserved tokens
+void clear_vocabulary(Vocabulary *vocab)
+{
+    for(int i = 0;i < VOCAB_CHUNK_NUM;i++)
+    {
+        delete[] vocab->chunk_list[i];
+        vocab->chunk_list[i] = NULL;
+    }
+    
+    unordered_map<string, unsigned int>().swap(vocab->index);
+    vocab->token_num = 0;
+    
+    return;
+}
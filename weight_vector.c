@@ -1,5 +1,729 @@
-
 #include "glm_parser.h"
 
-unordered_map<unsigned long, float> weight_vector;
+WeightTable weight_vector;
+
+WeightTable::WeightTable()
+{
+    entry_list = NULL;
+    sum_list = NULL;
+    stamp_list = NULL;
+    map_image = NULL;
+    map_len = 0;
+    init_weight_table(this, WEIGHT_INIT_CAPACITY);
+}
+
+static void unmap_model(WeightTable *table);
+
+WeightTable::~WeightTable()
+{
+    if(map_image != NULL) unmap_model(this);
+    else free(entry_list);
+    free(sum_list);
+    free(stamp_list);
+}
+
+static void alloc_average_list(WeightTable *table)
+{
+    table->sum_list = (double *)calloc(table->capacity + 1, sizeof(double));
+    table->stamp_list = 
+        (unsigned int *)calloc(table->capacity + 1, sizeof(unsigned int));
+    if(table->sum_list == NULL || table->stamp_list == NULL) 
+        ERROR("Allocate average of %lu entries fails!", table->capacity);
+    
+    return;
+}
+
+// capacity is rounded up to a power of two. Any existing entry is lost
+// If averaging is enabled it stays enabled, starting again from time 0
+void init_weight_table(WeightTable *table, unsigned long capacity)
+{
+    // At least two slots, so that shift stays below 64
+    unsigned long real_capacity = 2;
+    int bit_num = 1;
+    while(real_capacity < capacity) 
+    {
+        real_capacity <<= 1;
+        bit_num++;
+    }
+    
+    if(table->map_image != NULL) 
+    {
+        unmap_model(table);
+        table->entry_list = NULL;
+    }
+    free(table->entry_list);
+    // calloc() leaves every key as WEIGHT_EMPTY_KEY
+    table->entry_list = 
+        (WeightEntry *)calloc(real_capacity, sizeof(WeightEntry));
+    if(table->entry_list == NULL) 
+        ERROR("Allocate weight table of %lu entries fails!", real_capacity);
+    
+    table->capacity = real_capacity;
+    table->mask = real_capacity - 1;
+    table->shift = 64 - bit_num;
+    table->size = 0;
+    table->has_empty_key = false;
+    table->empty_key_weight = 0.0;
+    
+    bool average = table->sum_list != NULL;
+    free(table->sum_list);
+    free(table->stamp_list);
+    table->sum_list = NULL;
+    table->stamp_list = NULL;
+    if(average) alloc_average_list(table);
+    
+    table->average_time = 0;
+    table->average_final = false;
+    table->use_average = false;
+    
+    return;
+}
+
+void clear_weight_table(WeightTable *table)
+{
+    init_weight_table(table, WEIGHT_INIT_CAPACITY);
+    
+    return;
+}
+
+// Slot of feature h, which is added with weight 0.0 if it is not in the
+// table yet. WEIGHT_EMPTY_KEY has slot capacity
+static unsigned long find_or_insert_slot(WeightTable *table, unsigned long h);
+
+static float *get_slot_weight(WeightTable *table, unsigned long slot)
+{
+    if(slot == table->capacity) return &table->empty_key_weight;
+    
+    return &table->entry_list[slot].weight;
+}
+
+// Double the capacity and re-insert every entry
+static void grow_weight_table(WeightTable *table)
+{
+    WeightEntry *old_entry_list = table->entry_list;
+    double *old_sum_list = table->sum_list;
+    unsigned int *old_stamp_list = table->stamp_list;
+    unsigned long old_capacity = table->capacity;
+    bool has_empty_key = table->has_empty_key;
+    float empty_key_weight = table->empty_key_weight;
+    unsigned int average_time = table->average_time;
+    bool average_final = table->average_final;
+    bool use_average = table->use_average;
+    
+    table->entry_list = NULL;
+    table->sum_list = NULL;
+    table->stamp_list = NULL;
+    init_weight_table(table, old_capacity * 2);
+    if(old_sum_list != NULL) alloc_average_list(table);
+    
+    for(unsigned long i = 0;i < old_capacity;i++)
+    {
+        if(old_entry_list[i].key == WEIGHT_EMPTY_KEY) continue;
+        
+        unsigned long slot = find_or_insert_slot(table, old_entry_list[i].key);
+        table->entry_list[slot].weight = old_entry_list[i].weight;
+        table->entry_list[slot].type = old_entry_list[i].type;
+        if(old_sum_list != NULL)
+        {
+            table->sum_list[slot] = old_sum_list[i];
+            table->stamp_list[slot] = old_stamp_list[i];
+        }
+    }
+    
+    table->has_empty_key = has_empty_key;
+    table->empty_key_weight = empty_key_weight;
+    if(has_empty_key) table->size++;
+    if(old_sum_list != NULL)
+    {
+        table->sum_list[table->capacity] = old_sum_list[old_capacity];
+        table->stamp_list[table->capacity] = old_stamp_list[old_capacity];
+    }
+    
+    table->average_time = average_time;
+    table->average_final = average_final;
+    table->use_average = use_average;
+    
+    free(old_entry_list);
+    free(old_sum_list);
+    free(old_stamp_list);
+    
+    return;
+}
+
+// Grow the table until it could hold num keys without growing again
+// Do this before inserting all keys of another table in slot order: both
+// use the same hash, so if this one is smaller the keys come in runs that
+// land in the same few slots, and probing goes quadratic
+void reserve_weight_table(WeightTable *table, unsigned long num)
+{
+    while(num + 1 > table->capacity * WEIGHT_MAX_LOAD_FACTOR) 
+        grow_weight_table(table);
+    
+    return;
+}
+
+static unsigned long find_or_insert_slot(WeightTable *table, unsigned long h)
+{
+    if(table->map_image != NULL) 
+        ERROR("Weight table is a read only model file", 0);
+    
+    if(h == WEIGHT_EMPTY_KEY)
+    {
+        if(!table->has_empty_key)
+        {
+            table->has_empty_key = true;
+            table->size++;
+        }
+        
+        return table->capacity;
+    }
+    
+    if(table->size + 1 > table->capacity * WEIGHT_MAX_LOAD_FACTOR) 
+        grow_weight_table(table);
+    
+    unsigned long slot = get_weight_slot(table, h);
+    while(1)
+    {
+        WeightEntry *entry = &table->entry_list[slot];
+        
+        if(entry->key == h) return slot;
+        if(entry->key == WEIGHT_EMPTY_KEY)
+        {
+            entry->key = h;
+            entry->weight = 0.0;
+            entry->type = 0;
+            table->size++;
+            
+            return slot;
+        }
+        
+        slot = (slot + 1) & table->mask;
+    }
+}
+
+// Returns the weight of feature h, which is added with weight 0.0 if it
+// is not in the table yet. The pointer is valid until the next insertion
+// Writing through it bypasses averaging, use add_weight() for updates
+float *find_or_insert_weight(WeightTable *table, unsigned long h)
+{
+    return get_slot_weight(table, find_or_insert_slot(table, h));
+}
+
+// Bring the running sum of the slot up to the current time. The weight
+// has not changed since stamp_list[slot], so this is all the averaging
+// an update costs
+inline void touch_slot(WeightTable *table, unsigned long slot)
+{
+    table->sum_list[slot] += (double)*get_slot_weight(table, slot) * 
+                             (table->average_time - table->stamp_list[slot]);
+    table->stamp_list[slot] = table->average_time;
+    
+    return;
+}
+
+static unsigned long add_slot_weight(WeightTable *table, unsigned long h, 
+                                     float delta, unsigned int type)
+{
+    unsigned long slot = find_or_insert_slot(table, h);
+    
+    if(table->sum_list != NULL) 
+    {
+        if(table->average_final) 
+            ERROR("Weight table is updated after averaging", 0);
+        
+        touch_slot(table, slot);
+    }
+    *get_slot_weight(table, slot) += delta;
+    if(slot < table->capacity) table->entry_list[slot].type = type;
+    
+    return slot;
+}
+
+// Add delta to the weight of feature h, of the given type, at time 
+// table->average_time
+void add_weight(WeightTable *table, unsigned long h, float delta, 
+                unsigned int type)
+{
+    add_slot_weight(table, h, delta, type);
+    
+    return;
+}
+
+// Add delta to the weight of every feature in hash_list
+void add_feature_vector(WeightTable *table, const unsigned long *hash_list,
+                        const unsigned short *type_list, int num, float delta)
+{
+    for(int i = 0;i < num;i++) 
+        add_weight(table, hash_list[i], delta, type_list[i]);
+    
+    return;
+}
+
+// Sparse dot product of a feature vector (all values 1) with the table
+float dot_feature_vector(const WeightTable *table, 
+                         const unsigned long *hash_list, int num)
+{
+    float score = 0.0;
+    
+    for(int i = 0;i < num;i++) score += get_table_weight(table, hash_list[i]);
+    
+    return score;
+}
+
+// table += delta * mix, at time table->average_time. If both tables are
+// averaged, the running sums of delta, brought up to delta->average_time,
+// are added to those of table as they are, since they count time steps
+// that table has not seen
+void merge_weight_table(WeightTable *table, const WeightTable *delta, 
+                        float mix)
+{
+    reserve_weight_table(table, table->size + delta->size);
+    bool merge_sum = table->sum_list != NULL && delta->sum_list != NULL;
+    
+    for(unsigned long i = 0;i <= delta->capacity;i++)
+    {
+        unsigned long key;
+        float weight;
+        unsigned int type = 0;
+        
+        if(i == delta->capacity)
+        {
+            if(!delta->has_empty_key) continue;
+            
+            key = WEIGHT_EMPTY_KEY;
+            weight = delta->empty_key_weight;
+        }
+        else
+        {
+            if(delta->entry_list[i].key == WEIGHT_EMPTY_KEY) continue;
+            
+            key = delta->entry_list[i].key;
+            weight = delta->entry_list[i].weight;
+            type = delta->entry_list[i].type;
+        }
+        
+        unsigned long slot = add_slot_weight(table, key, weight * mix, type);
+        if(merge_sum)
+        {
+            table->sum_list[slot] += delta->sum_list[i] + (double)weight * 
+                (delta->average_time - delta->stamp_list[i]);
+        }
+    }
+    
+    return;
+}
+
+// Start keeping running sums for averaging. Time starts at 0, and the
+// caller advances table->average_time once per training step
+void enable_weight_average(WeightTable *table)
+{
+    if(table->sum_list != NULL) return;
+    
+    alloc_average_list(table);
+    table->average_time = 0;
+    table->average_final = false;
+    table->use_average = false;
+    
+    return;
+}
+
+// Turn running sums into averages over table->average_time steps. This
+// is the only pass over the whole table. Afterwards the table could still
+// be read, raw or averaged, but not updated
+void finalize_weight_average(WeightTable *table)
+{
+    if(table->sum_list == NULL) 
+        ERROR("Weight table does not keep averages", 0);
+    if(table->average_final) return;
+    if(table->average_time == 0) 
+        ERROR("Nothing to average: average time is 0", 0);
+    
+    for(unsigned long i = 0;i <= table->capacity;i++)
+    {
+        touch_slot(table, i);
+        table->sum_list[i] /= table->average_time;
+    }
+    
+    table->average_final = true;
+    
+    return;
+}
+
+// Switch lookups between raw and averaged weights. Nothing is copied
+void set_weight_average(WeightTable *table, bool use_average)
+{
+    if(use_average && !table->average_final) 
+        ERROR("Weight average has not been finalized", 0);
+    
+    table->use_average = use_average;
+    
+    return;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Model file
+
+// Write the table, averaged if that is how it is being read. The file is
+// written under a temporary name and renamed, so that processes mapping
+// the old model are not affected
+void save_model(const WeightTable *table, string model_path)
+{
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    
+    header.magic = MODEL_FILE_MAGIC;
+    header.version = MODEL_FILE_VERSION;
+    header.hash_version = FEATURE_HASH_VERSION;
+    header.entry_size = sizeof(WeightEntry);
+    header.has_empty_key = table->has_empty_key;
+    header.empty_key_weight = get_table_weight(table, WEIGHT_EMPTY_KEY);
+    header.capacity = table->capacity;
+    header.size = table->size;
+    header.entry_offset = sizeof(ModelFileHeader);
+    
+    string tmp_path = model_path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "wb");
+    if(fp == NULL) ERROR("Open file %s fails!", tmp_path.c_str());
+    
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    if(!table->use_average)
+    {
+        ok = ok && fwrite(table->entry_list, sizeof(WeightEntry), 
+                          table->capacity, fp) == table->capacity;
+    }
+    else
+    {
+        vector<WeightEntry> entry_list(table->entry_list, 
+                                       table->entry_list + table->capacity);
+        for(unsigned long i = 0;i < table->capacity;i++)
+            entry_list[i].weight = table->sum_list[i];
+        
+        ok = ok && fwrite(&entry_list[0], sizeof(WeightEntry), 
+                          table->capacity, fp) == table->capacity;
+    }
+    
+    if(fclose(fp) != 0 || !ok) ERROR("Write model %s fails!", tmp_path.c_str());
+    if(rename(tmp_path.c_str(), model_path.c_str()) != 0)
+        ERROR("Rename %s fails!", tmp_path.c_str());
+    
+    return;
+}
+
+static void release_model_image(void *image, size_t len)
+{
+#ifndef _WIN32
+    munmap(image, len);
+#else
+    free(image);
+#endif
+    
+    return;
+}
+
+static void unmap_model(WeightTable *table)
+{
+    release_model_image(table->map_image, table->map_len);
+    
+    table->map_image = NULL;
+    table->map_len = 0;
+    
+    return;
+}
+
+// Make table a read only view of the model file. Pages are only read
+// when they are probed, so this takes the same time whatever the model
+// size, and processes mapping the same file share one copy in the page
+// cache. Returns false, leaving table as it is, if the file cannot be 
+// read or was written with another format or hash
+bool map_model(WeightTable *table, string model_path)
+{
+    void *image;
+    size_t len;
+    
+#ifndef _WIN32
+    int fd = open(model_path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0 || 
+       (size_t)file_stat.st_size < sizeof(ModelFileHeader)) 
+    {
+        close(fd);
+        return false;
+    }
+    
+    len = file_stat.st_size;
+    image = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) return false;
+    
+    // Lookups jump all over the table, read ahead would be wasted
+    madvise(image, len, MADV_RANDOM);
+#else
+    FILE *fp = fopen(model_path.c_str(), "rb");
+    if(fp == NULL) return false;
+    
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    image = malloc(len);
+    if(image == NULL || fread(image, 1, len, fp) != len)
+    {
+        free(image);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+#endif
+    
+    const ModelFileHeader *header = (const ModelFileHeader *)image;
+    bool valid = len >= sizeof(ModelFileHeader) &&
+                 header->magic == MODEL_FILE_MAGIC &&
+                 header->version == MODEL_FILE_VERSION &&
+                 header->hash_version == FEATURE_HASH_VERSION &&
+                 header->entry_size == sizeof(WeightEntry) &&
+                 header->capacity > 1 && 
+                 (header->capacity & (header->capacity - 1)) == 0 &&
+                 header->entry_offset % sizeof(uint64_t) == 0 &&
+                 header->entry_offset + header->capacity * sizeof(WeightEntry) <= len;
+    
+    if(!valid)
+    {
+        release_model_image(image, len);
+        
+        return false;
+    }
+    
+    // Drop whatever the table had, then point it at the file
+    if(table->map_image != NULL) unmap_model(table);
+    else free(table->entry_list);
+    free(table->sum_list);
+    free(table->stamp_list);
+    table->sum_list = NULL;
+    table->stamp_list = NULL;
+    table->average_time = 0;
+    table->average_final = false;
+    table->use_average = false;
+    
+    int bit_num = 0;
+    while((1UL << bit_num) < header->capacity) bit_num++;
+    
+    table->entry_list = (WeightEntry *)((char *)image + header->entry_offset);
+    table->capacity = header->capacity;
+    table->mask = header->capacity - 1;
+    table->shift = 64 - bit_num;
+    table->size = header->size;
+    table->has_empty_key = header->has_empty_key != 0;
+    table->empty_key_weight = header->empty_key_weight;
+    table->map_image = image;
+    table->map_len = len;
+    
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Test code
+
+// Lookup through std::unordered_map the way get_weight() used to do it
+static float get_map_weight(unordered_map<unsigned long, float> *map, 
+                            unsigned long h)
+{
+    if(map->count(h) == 0) return 0.0;
+    else return map->at(h);
+}
+
+// Fill both the old unordered_map and WeightTable with feature_num random
+// features, and time lookup_num lookups of which half are misses
+int test_weight_table(unsigned long feature_num, unsigned long lookup_num)
+{
+    unordered_map<unsigned long, float> map;
+    vector<unsigned long> key_list;
+    
+    // Feature hashes are products of HASH_MULTIPLIER, so spread them
+    // the same way instead of using small consecutive integers
+    unsigned long h = 1;
+    clear_weight_table(&weight_vector);
+    for(unsigned long i = 0;i < feature_num;i++)
+    {
+        h = h * HASH_MULTIPLIER + i;
+        float weight = (float)(i % 1000) / 1000.0;
+        
+        map[h] = weight;
+        *find_or_insert_weight(&weight_vector, h) = weight;
+        key_list.push_back(h);
+    }
+    
+    // Odd lookups are misses
+    vector<unsigned long> lookup_list;
+    srand(0);
+    for(unsigned long i = 0;i < lookup_num;i++)
+    {
+        unsigned long key = key_list[((unsigned long)rand() * 65536 + rand()) % 
+                                     feature_num];
+        lookup_list.push_back(i % 2 ? key * HASH_MULTIPLIER + 25 : key);
+    }
+    
+    float map_sum = 0.0, table_sum = 0.0;
+    
+    double start_time = get_wall_time();
+    for(unsigned long i = 0;i < lookup_num;i++) 
+        map_sum += get_map_weight(&map, lookup_list[i]);
+    double map_time = get_wall_time() - start_time;
+    
+    start_time = get_wall_time();
+    for(unsigned long i = 0;i < lookup_num;i++) 
+        table_sum += get_weight(lookup_list[i]);
+    double table_time = get_wall_time() - start_time;
+    
+    // Same loop, but prefetch a few lookups ahead
+    float prefetch_sum = 0.0;
+    start_time = get_wall_time();
+    for(unsigned long i = 0;i < lookup_num;i++) 
+    {
+        if(i + 8 < lookup_num) prefetch_weight(lookup_list[i + 8]);
+        prefetch_sum += get_weight(lookup_list[i]);
+    }
+    double prefetch_time = get_wall_time() - start_time;
+    
+    DEBUG("Weight table: %lu features, %lu lookups, sum %f %f %f\n"
+          "unordered_map %.1f M/s, WeightTable %.1f M/s, with prefetch %.1f M/s",
+          feature_num, lookup_num, map_sum, table_sum, prefetch_sum,
+          lookup_num / map_time / 1e6, lookup_num / table_time / 1e6,
+          lookup_num / prefetch_time / 1e6);
+    
+    clear_weight_table(&weight_vector);
+    
+    return map_sum == table_sum && table_sum == prefetch_sum ? 0 : 1;
+}
+
+// Run step_num steps of update_num random updates over feature_num 
+// features, averaging both lazily and by adding every weight into a sum
+// after every step, and compare the averages
+// Returns the number of features whose averages differ
+int test_weight_average(unsigned long feature_num, int step_num, 
+                        int update_num)
+{
+    WeightTable table;
+    vector<float> naive_weight(feature_num, 0.0);
+    vector<double> naive_sum(feature_num, 0.0);
+    vector<unsigned long> key_list;
+    
+    unsigned long h = 1;
+    for(unsigned long i = 0;i < feature_num;i++)
+    {
+        h = h * HASH_MULTIPLIER + i;
+        key_list.push_back(h);
+    }
+    
+    vector<unsigned long> update_list;
+    srand(0);
+    for(long i = 0;i < (long)step_num * update_num;i++) 
+        update_list.push_back(((unsigned long)rand() * 65536 + rand()) % 
+                              feature_num);
+    
+    double start_time = get_wall_time();
+    for(int step = 0;step < step_num;step++)
+    {
+        for(int i = 0;i < update_num;i++)
+        {
+            unsigned long feature = update_list[(long)step * update_num + i];
+            naive_weight[feature] += i % 2 ? 1.0 : -1.0;
+        }
+        
+        for(unsigned long i = 0;i < feature_num;i++) 
+            naive_sum[i] += naive_weight[i];
+    }
+    double naive_time = get_wall_time() - start_time;
+    
+    start_time = get_wall_time();
+    enable_weight_average(&table);
+    for(int step = 0;step < step_num;step++)
+    {
+        table.average_time = step;
+        for(int i = 0;i < update_num;i++)
+        {
+            unsigned long feature = update_list[(long)step * update_num + i];
+            add_weight(&table, key_list[feature], i % 2 ? 1.0 : -1.0, 0);
+        }
+    }
+    table.average_time = step_num;
+    finalize_weight_average(&table);
+    double lazy_time = get_wall_time() - start_time;
+    
+    int mismatch = 0;
+    set_weight_average(&table, true);
+    for(unsigned long i = 0;i < feature_num;i++)
+    {
+        float average = get_table_weight(&table, key_list[i]);
+        if(fabs(average - naive_sum[i] / step_num) > 1e-4) mismatch++;
+    }
+    
+    set_weight_average(&table, false);
+    for(unsigned long i = 0;i < feature_num;i++)
+    {
+        if(get_table_weight(&table, key_list[i]) != naive_weight[i]) 
+            mismatch++;
+    }
+    
+    DEBUG("Weight average: %lu features, %d steps of %d updates, "
+          "naive %.3f s, lazy %.3f s, mismatch = %d", feature_num, step_num,
+          update_num, naive_time, lazy_time, mismatch);
+    
+    return mismatch;
+}
 
+// Save a table of feature_num random features for two sizes, map each
+// back, and check every key and some misses. Mapping should take about
+// the same time for both sizes. Returns the number of wrong lookups
+int test_model_file(string model_path)
+{
+    static const unsigned long feature_num_list[] = {100000, 4000000};
+    int mismatch = 0;
+    
+    for(int i = 0;i < 2;i++)
+    {
+        WeightTable table, model;
+        unsigned long feature_num = feature_num_list[i];
+        
+        unsigned long h = 1;
+        for(unsigned long j = 0;j < feature_num;j++)
+        {
+            h = h * HASH_MULTIPLIER + j;
+            *find_or_insert_weight(&table, h) = (float)(j % 1000) / 1000.0;
+        }
+        *find_or_insert_weight(&table, WEIGHT_EMPTY_KEY) = 0.5;
+        
+        double start_time = get_wall_time();
+        save_model(&table, model_path);
+        double save_time = get_wall_time() - start_time;
+        
+        start_time = get_wall_time();
+        if(!map_model(&model, model_path)) 
+            ERROR("Model %s is not valid", model_path.c_str());
+        double map_time = get_wall_time() - start_time;
+        
+        start_time = get_wall_time();
+        h = 1;
+        for(unsigned long j = 0;j < feature_num;j++)
+        {
+            h = h * HASH_MULTIPLIER + j;
+            if(get_table_weight(&model, h) != get_table_weight(&table, h) ||
+               get_table_weight(&model, h * HASH_MULTIPLIER + 25) != 
+               get_table_weight(&table, h * HASH_MULTIPLIER + 25)) 
+                mismatch++;
+        }
+        if(get_table_weight(&model, WEIGHT_EMPTY_KEY) != 0.5) mismatch++;
+        double lookup_time = get_wall_time() - start_time;
+        
+        DEBUG("Model file: %lu features, %.1f MB, save %.3f s, map %.3f ms, "
+              "%.1f M lookups/s", feature_num, model.map_len / 1048576.0,
+              save_time, map_time * 1000.0, 
+              feature_num * 2 / lookup_time / 1e6);
+    }
+    
+    remove(model_path.c_str());
+    DEBUG("Model file: mismatch = %d", mismatch);
+    
+    return mismatch;
+}